@@ -0,0 +1,278 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+#if defined(CURRENCY_CONVERTER_MIMALLOC)
+#include <mimalloc.h>
+#endif
+
+/*
+	Allocation accounting by route and request phase.
+
+	The server's operator new and operator delete go through here when it is
+	compiled with CURRENCY_CONVERTER_ALLOC_STATS. Each allocation carries a
+	16-byte header with its size and the tag of the code that made it, so a
+	release is credited back to the route that allocated, whichever route
+	frees it. Counters are relaxed atomics, one cache line per route.
+
+	The tag is a thread-local set by a scope around the synchronous parts of
+	answering a request. A coroutine that suspends inside a scope has to
+	clear it first with a suspension, or another connection's work on the
+	thread would be counted against it. Anything allocated outside a scope
+	(socket and parser buffers filled by I/O completions, TLS, the rate
+	refresher) is counted as unattributed.
+
+	With CURRENCY_CONVERTER_MIMALLOC the memory itself comes from mimalloc;
+	jemalloc replaces malloc when it is linked, so it needs no code here.
+*/
+
+namespace alloc_stats
+{
+	enum class route : std::uint8_t
+	{
+		unattributed,
+		static_file,
+		list,
+		convert,
+		convert_all,
+		batch,
+		locate,
+		diagnostics,
+		count
+	};
+
+	inline constexpr std::array<std::string_view, static_cast<std::size_t>(route::count)> route_names{
+		"unattributed",
+		"static",
+		"list",
+		"convert",
+		"convert_all",
+		"batch",
+		"locate",
+		"diagnostics"
+	};
+
+	enum class phase : std::uint8_t
+	{
+		handle,     // building the response
+		parse,      // parsing the request body or query
+		render,     // rendering the page template
+		count
+	};
+
+	inline constexpr std::array<std::string_view, static_cast<std::size_t>(phase::count)> phase_names{
+		"handle",
+		"parse",
+		"render"
+	};
+
+	inline constexpr std::size_t route_count = static_cast<std::size_t>(route::count);
+	inline constexpr std::size_t phase_count = static_cast<std::size_t>(phase::count);
+
+#if defined(CURRENCY_CONVERTER_ALLOC_STATS)
+	inline constexpr bool enabled = true;
+#else
+	inline constexpr bool enabled = false;
+#endif
+
+#if defined(CURRENCY_CONVERTER_MIMALLOC)
+	inline constexpr std::string_view allocator_name{ "mimalloc" };
+#elif defined(CURRENCY_CONVERTER_JEMALLOC)
+	inline constexpr std::string_view allocator_name{ "jemalloc" };
+#else
+	inline constexpr std::string_view allocator_name{ "system" };
+#endif
+
+	// Where the memory comes from, accounted or not
+	namespace backing
+	{
+		inline void *allocate(std::size_t size, std::size_t align)
+		{
+#if defined(CURRENCY_CONVERTER_MIMALLOC)
+			return mi_malloc_aligned(size, align);
+#elif defined(_MSC_VER)
+			return _aligned_malloc(size, align);
+#else
+			return align <= alignof(std::max_align_t) ? std::malloc(size)
+				: std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+		}
+
+		inline void release(void *p)
+		{
+#if defined(CURRENCY_CONVERTER_MIMALLOC)
+			mi_free(p);
+#elif defined(_MSC_VER)
+			_aligned_free(p);
+#else
+			std::free(p);
+#endif
+		}
+	}
+
+	// Totals for one route, or for one phase of one
+	struct totals
+	{
+		std::uint64_t allocations{ 0 };
+		std::uint64_t bytes{ 0 };
+	};
+
+	// Everything counted for a route; live and peak are bytes in use
+	struct route_totals
+	{
+		std::array<totals, phase_count> phases{};
+		std::uint64_t live{ 0 };
+		std::uint64_t peak{ 0 };
+	};
+
+	namespace detail
+	{
+		struct alignas(64) route_counters
+		{
+			std::array<std::atomic<std::uint64_t>, phase_count> allocations{};
+			std::array<std::atomic<std::uint64_t>, phase_count> bytes{};
+			std::atomic<std::int64_t> live{ 0 };
+			std::atomic<std::int64_t> peak{ 0 };
+		};
+
+		// Sits just before every accounted allocation
+		struct alignas(16) header
+		{
+			std::uint64_t size;
+			std::uint32_t offset;   // from the start of the block to the user's pointer
+			std::uint8_t tag;
+		};
+		static_assert(sizeof(header) == 16);
+
+		inline std::array<route_counters, route_count> counters{};
+		inline thread_local std::uint8_t current_tag{ 0 };
+
+		inline std::uint8_t make_tag(route r, phase p)
+		{
+			return static_cast<std::uint8_t>(static_cast<std::size_t>(r) * phase_count + static_cast<std::size_t>(p));
+		}
+	}
+
+	// Identifies a route and phase
+	using tag_type = std::uint8_t;
+
+	// The tag this thread's allocations are counted against, for work
+	// handed to another thread to carry with it
+	inline tag_type current()
+	{
+		return detail::current_tag;
+	}
+
+	// Counts allocations made on this thread against a route and phase
+	// until it is destroyed, then goes back to the enclosing tag
+	class scope
+	{
+	public:
+		scope(route r, phase p)
+			: scope{ detail::make_tag(r, p) }
+		{
+		}
+
+		explicit scope(tag_type tag)
+			: m_saved{ detail::current_tag }
+		{
+			detail::current_tag = tag;
+		}
+
+		~scope()
+		{
+			detail::current_tag = m_saved;
+		}
+
+		scope(const scope &) = delete;
+		scope &operator=(const scope &) = delete;
+
+	private:
+		const std::uint8_t m_saved;
+	};
+
+	// Clears the tag while a coroutine is suspended and puts it back, on
+	// whichever thread the coroutine resumes on, when it is destroyed
+	class suspension
+	{
+	public:
+		suspension()
+			: m_saved{ detail::current_tag }
+		{
+			detail::current_tag = 0;
+		}
+
+		~suspension()
+		{
+			detail::current_tag = m_saved;
+		}
+
+		suspension(const suspension &) = delete;
+		suspension &operator=(const suspension &) = delete;
+
+	private:
+		const std::uint8_t m_saved;
+	};
+
+	// Allocates size bytes aligned to align, counted against the current tag
+	inline void *allocate(std::size_t size, std::size_t align)
+	{
+		const auto offset{ std::max(align, sizeof(detail::header)) };
+		auto *block{ static_cast<std::byte *>(backing::allocate(size + offset, offset)) };
+		if (!block)
+		{
+			return nullptr;
+		}
+		auto *p{ block + offset };
+		const auto tag{ detail::current_tag };
+		new (p - sizeof(detail::header)) detail::header{ size, static_cast<std::uint32_t>(offset), tag };
+
+		auto &c{ detail::counters[tag / phase_count] };
+		c.allocations[tag % phase_count].fetch_add(1, std::memory_order_relaxed);
+		c.bytes[tag % phase_count].fetch_add(size, std::memory_order_relaxed);
+		const auto live{ c.live.fetch_add(static_cast<std::int64_t>(size), std::memory_order_relaxed) + static_cast<std::int64_t>(size) };
+		auto peak{ c.peak.load(std::memory_order_relaxed) };
+		while (live > peak && !c.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+		{
+		}
+		return p;
+	}
+
+	// Frees what allocate() returned and credits the route that allocated it
+	inline void release(void *ptr)
+	{
+		if (!ptr)
+		{
+			return;
+		}
+		auto *p{ static_cast<std::byte *>(ptr) };
+		const auto *h{ reinterpret_cast<const detail::header *>(p - sizeof(detail::header)) };
+		detail::counters[h->tag / phase_count].live.fetch_sub(static_cast<std::int64_t>(h->size), std::memory_order_relaxed);
+		backing::release(p - h->offset);
+	}
+
+	// A copy of the counters for one route
+	inline route_totals snapshot(route r)
+	{
+		const auto &c{ detail::counters[static_cast<std::size_t>(r)] };
+		route_totals result;
+		for (std::size_t i{ 0 }; i != phase_count; ++i)
+		{
+			result.phases[i] = { c.allocations[i].load(std::memory_order_relaxed), c.bytes[i].load(std::memory_order_relaxed) };
+		}
+		// Frees can race ahead of the allocations they match in a copy like this
+		result.live = static_cast<std::uint64_t>(std::max<std::int64_t>(0, c.live.load(std::memory_order_relaxed)));
+		result.peak = static_cast<std::uint64_t>(c.peak.load(std::memory_order_relaxed));
+		return result;
+	}
+}
+
+#endif
@@ -0,0 +1,444 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "rates.hpp"
+
+#include <boost/beast/http/message.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/*
+	Traffic capture for replaying production load against another build.
+
+	A capture file starts with an 8-byte magic and the capture's start time,
+	followed by records, each one a type byte, a varint payload length and
+	the payload. Integers are LEB128 varints and strings are a varint length
+	followed by the bytes, so a typical request record is a few hundred
+	bytes. Request records carry the arrival time, the connection and its
+	request number (so keep-alive patterns can be replayed), the method,
+	target, headers and body. The rate snapshot and currency list in use
+	are written whenever they change, so a replay can serve the same rates.
+
+	Requests are encoded on the session's thread and appended to a buffer
+	under a lock; a background thread writes the buffer out, so sessions
+	never wait on the disk. Cookies and authorization headers are never
+	recorded, digits in bodies and query strings are replaced when scrubbing
+	is on, and CSV uploads are recorded without their bodies.
+*/
+
+namespace capture
+{
+	inline constexpr std::string_view magic{ "CCCAPT01" };
+
+	enum class record_type : std::uint8_t
+	{
+		request = 1,
+		rates = 2,
+		currency_list = 3
+	};
+
+	struct request_record
+	{
+		std::uint64_t arrival_us{ 0 };  // since the capture started
+		std::uint64_t connection{ 0 };
+		std::uint32_t sequence{ 0 };    // the request's number on its connection
+		bool http2{ false };
+		bool scrubbed{ false };
+		bool body_omitted{ false };
+		std::string method;
+		std::string target;
+		std::vector<std::pair<std::string, std::string>> headers;
+		std::string body;
+	};
+
+	using record = std::variant<request_record, rate_snapshot, std::string>;
+
+	namespace detail
+	{
+		enum flags : std::uint8_t
+		{
+			http2 = 1,
+			scrubbed = 2,
+			body_omitted = 4
+		};
+
+		inline void put_varint(std::string &out, std::uint64_t v)
+		{
+			while (v >= 0x80)
+			{
+				out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+				v >>= 7;
+			}
+			out.push_back(static_cast<char>(v));
+		}
+
+		inline void put_string(std::string &out, std::string_view s)
+		{
+			put_varint(out, s.size());
+			out.append(s);
+		}
+
+		inline void put_record(std::string &out, record_type type, std::string_view payload)
+		{
+			out.push_back(static_cast<char>(type));
+			put_string(out, payload);
+		}
+
+		// Reads from a payload; throws std::runtime_error when it runs out
+		class cursor
+		{
+		public:
+			explicit cursor(std::string_view data)
+				: m_data{ data }
+			{
+			}
+
+			std::uint64_t varint()
+			{
+				std::uint64_t v{ 0 };
+				for (unsigned shift{ 0 }; shift < 64; shift += 7)
+				{
+					const auto byte{ static_cast<std::uint8_t>(take(1).front()) };
+					v |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+					if ((byte & 0x80) == 0)
+					{
+						return v;
+					}
+				}
+				throw std::runtime_error{ "Bad varint in capture" };
+			}
+
+			std::string_view string()
+			{
+				return take(static_cast<std::size_t>(varint()));
+			}
+
+			std::string_view take(std::size_t n)
+			{
+				if (n > m_data.size())
+				{
+					throw std::runtime_error{ "Truncated capture record" };
+				}
+				const auto taken{ m_data.substr(0, n) };
+				m_data.remove_prefix(n);
+				return taken;
+			}
+
+		private:
+			std::string_view m_data;
+		};
+	}
+
+	// Appends captured requests to a file from a background thread
+	class recorder
+	{
+	public:
+		// Buffered bytes beyond which records are dropped rather than queued
+		static constexpr std::size_t max_pending = 16 * 1024 * 1024;
+
+		recorder(const std::string &path, bool scrub)
+			: m_file{ path, std::ios::binary | std::ios::trunc }, m_scrub{ scrub },
+			m_start{ std::chrono::steady_clock::now() }
+		{
+			if (!m_file)
+			{
+				throw std::runtime_error{ "Can't create capture file " + path };
+			}
+			m_pending.append(magic);
+			detail::put_varint(m_pending, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count()));
+			m_thread = std::thread{ [this] { run(); } };
+		}
+
+		~recorder()
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_mutex };
+				m_stopping = true;
+			}
+			m_wake.notify_one();
+			m_thread.join();
+		}
+
+		recorder(const recorder &) = delete;
+		recorder &operator=(const recorder &) = delete;
+
+		// Records one request, preceded by the rates and list serving it if
+		// they have changed since the last request recorded
+		template<bool isRequest, class Fields>
+		void request(std::uint64_t connection, std::uint32_t sequence, bool http2,
+			const boost::beast::http::header<isRequest, Fields> &header, std::string_view body, bool body_omitted,
+			const std::shared_ptr<const rate_snapshot> &rates, const std::shared_ptr<const std::string> &list)
+		{
+			const auto arrival{ static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - m_start).count()) };
+
+			std::string payload;
+			payload.reserve(256 + body.size());
+			detail::put_varint(payload, arrival);
+			detail::put_varint(payload, connection);
+			detail::put_varint(payload, sequence);
+			payload.push_back(static_cast<char>((http2 ? detail::http2 : 0) | (m_scrub ? detail::scrubbed : 0)
+				| (body_omitted ? detail::body_omitted : 0)));
+			const auto method{ header.method_string() };
+			detail::put_string(payload, { method.data(), method.size() });
+			const auto target{ header.target() };
+			detail::put_string(payload, { target.data(), target.size() });
+			if (m_scrub)
+			{
+				// A map location in the query is as private as an amount
+				scrub(payload, payload.size() - target.size() + std::min(target.find('?'), target.size()));
+			}
+
+			std::size_t count{ 0 };
+			for (const auto &field : header)
+			{
+				count += recordable(field.name()) ? 1 : 0;
+			}
+			detail::put_varint(payload, count);
+			for (const auto &field : header)
+			{
+				if (recordable(field.name()))
+				{
+					const auto name{ field.name_string() };
+					const auto value{ field.value() };
+					detail::put_string(payload, { name.data(), name.size() });
+					detail::put_string(payload, { value.data(), value.size() });
+				}
+			}
+
+			detail::put_string(payload, body_omitted ? std::string_view{} : body);
+			if (m_scrub)
+			{
+				// A form's boundary has to match its Content-Type to be parsed
+				const auto content_type{ header[boost::beast::http::field::content_type] };
+				const auto boundary{ content_type.find("boundary=") };
+				scrub(payload, payload.size() - (body_omitted ? 0 : body.size()),
+					boundary == content_type.npos ? std::string_view{}
+					: std::string_view{ content_type.data() + boundary + 9, content_type.size() - boundary - 9 });
+			}
+
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			if (m_pending.size() + payload.size() > max_pending)
+			{
+				++m_dropped;
+				return;
+			}
+			if (rates && rates != m_last_rates)
+			{
+				m_last_rates = rates;
+				detail::put_record(m_pending, record_type::rates, encode(*rates));
+			}
+			if (list && list != m_last_list)
+			{
+				m_last_list = list;
+				detail::put_record(m_pending, record_type::currency_list, *list);
+			}
+			detail::put_record(m_pending, record_type::request, payload);
+		}
+
+		// Requests not recorded because the writer had fallen behind
+		std::uint64_t dropped() const
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			return m_dropped;
+		}
+
+		// The payload of a rates record
+		static std::string encode(const rate_snapshot &rates)
+		{
+			std::string payload;
+			detail::put_varint(payload, static_cast<std::uint64_t>(rates.timestamp));
+			detail::put_varint(payload, rates.codes.size());
+			for (std::size_t i{ 0 }; i != rates.codes.size(); ++i)
+			{
+				detail::put_varint(payload, rates.codes[i]);
+				std::uint64_t bits;
+				std::memcpy(&bits, &rates.rates[i], sizeof bits);
+				detail::put_varint(payload, bits);
+			}
+			return payload;
+		}
+
+	private:
+		// Replaces every digit from the given offset on, keeping the length
+		// and skipping over any occurrence of keep
+		static void scrub(std::string &payload, std::size_t from, std::string_view keep = {})
+		{
+			for (auto i{ from }; i < payload.size(); ++i)
+			{
+				if (!keep.empty() && std::string_view{ payload }.substr(i, keep.size()) == keep)
+				{
+					i += keep.size() - 1;
+				}
+				else if (payload[i] >= '0' && payload[i] <= '9')
+				{
+					payload[i] = '1';
+				}
+			}
+		}
+
+		static bool recordable(boost::beast::http::field name)
+		{
+			using boost::beast::http::field;
+			return name != field::cookie && name != field::authorization && name != field::proxy_authorization;
+		}
+
+		void run()
+		{
+			std::string writing;
+			std::unique_lock<std::mutex> lock{ m_mutex };
+			for (;;)
+			{
+				m_wake.wait_for(lock, std::chrono::milliseconds{ 200 }, [this] { return m_stopping; });
+				writing.swap(m_pending);
+				const bool stopping{ m_stopping };
+				lock.unlock();
+				m_file.write(writing.data(), static_cast<std::streamsize>(writing.size()));
+				m_file.flush();
+				writing.clear();
+				lock.lock();
+				if (stopping)
+				{
+					break;
+				}
+			}
+		}
+
+		std::ofstream m_file;
+		const bool m_scrub;
+		const std::chrono::steady_clock::time_point m_start;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::string m_pending;
+		std::shared_ptr<const rate_snapshot> m_last_rates;
+		std::shared_ptr<const std::string> m_last_list;
+		std::uint64_t m_dropped{ 0 };
+		bool m_stopping{ false };
+		std::thread m_thread;
+	};
+
+	// Reads a capture file back one record at a time
+	class reader
+	{
+	public:
+		explicit reader(const std::string &path)
+			: m_file{ path, std::ios::binary }
+		{
+			std::string header(magic.size(), '\0');
+			if (!m_file.read(header.data(), static_cast<std::streamsize>(header.size())) || header != magic)
+			{
+				throw std::runtime_error{ path + " isn't a capture file" };
+			}
+			m_started_us = read_varint();
+		}
+
+		// The rate snapshot in a payload written by recorder::encode()
+		static rate_snapshot decode(std::string_view payload)
+		{
+			detail::cursor in{ payload };
+			rate_snapshot rates;
+			rates.timestamp = static_cast<std::int64_t>(in.varint());
+			for (auto count{ in.varint() }; count != 0; --count)
+			{
+				rates.codes.push_back(static_cast<std::uint32_t>(in.varint()));
+				const auto bits{ in.varint() };
+				double rate;
+				std::memcpy(&rate, &bits, sizeof rate);
+				rates.rates.push_back(rate);
+			}
+			return rates;
+		}
+
+		// When the capture started, in microseconds since the Unix epoch
+		std::uint64_t started_us() const
+		{
+			return m_started_us;
+		}
+
+		// The next record, or nothing at the end of the file
+		std::optional<record> next()
+		{
+			const auto type{ m_file.get() };
+			if (type == std::char_traits<char>::eof())
+			{
+				return std::nullopt;
+			}
+			std::string payload(static_cast<std::size_t>(read_varint()), '\0');
+			if (!m_file.read(payload.data(), static_cast<std::streamsize>(payload.size())))
+			{
+				throw std::runtime_error{ "Truncated capture record" };
+			}
+
+			detail::cursor in{ payload };
+			switch (static_cast<record_type>(type))
+			{
+			case record_type::request:
+			{
+				request_record r;
+				r.arrival_us = in.varint();
+				r.connection = in.varint();
+				r.sequence = static_cast<std::uint32_t>(in.varint());
+				const auto flags{ static_cast<std::uint8_t>(in.take(1).front()) };
+				r.http2 = (flags & detail::http2) != 0;
+				r.scrubbed = (flags & detail::scrubbed) != 0;
+				r.body_omitted = (flags & detail::body_omitted) != 0;
+				r.method = in.string();
+				r.target = in.string();
+				for (auto count{ in.varint() }; count != 0; --count)
+				{
+					std::string name{ in.string() };
+					r.headers.emplace_back(std::move(name), in.string());
+				}
+				r.body = in.string();
+				return record{ std::move(r) };
+			}
+			case record_type::rates:
+				return record{ decode(payload) };
+			case record_type::currency_list:
+				return record{ std::string{ payload } };
+			}
+			throw std::runtime_error{ "Unknown capture record type" };
+		}
+
+	private:
+		std::uint64_t read_varint()
+		{
+			std::uint64_t v{ 0 };
+			for (unsigned shift{ 0 }; shift < 64; shift += 7)
+			{
+				const auto byte{ m_file.get() };
+				if (byte == std::char_traits<char>::eof())
+				{
+					throw std::runtime_error{ "Truncated capture record" };
+				}
+				v |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					return v;
+				}
+			}
+			throw std::runtime_error{ "Bad varint in capture" };
+		}
+
+		std::ifstream m_file;
+		std::uint64_t m_started_us{ 0 };
+	};
+}
+
+#endif
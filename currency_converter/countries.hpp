@@ -0,0 +1,285 @@
+#ifndef COUNTRIES_H
+#define COUNTRIES_H
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+/*
+	The currency used in each country or region, by ISO 3166-1 alpha-2 code
+	(XK for Kosovo), sorted by code for binary search. Antarctica is given
+	XCD, as the app always has.
+*/
+
+struct country_info
+{
+	char code[3];
+	char currency[4];
+	const char *name;
+};
+
+inline constexpr std::array<country_info, 250> countries{ {
+	{ "AD", "EUR", "Andorra" },
+	{ "AE", "AED", "United Arab Emirates" },
+	{ "AF", "AFN", "Afghanistan" },
+	{ "AG", "XCD", "Antigua and Barbuda" },
+	{ "AI", "XCD", "Anguilla" },
+	{ "AL", "ALL", "Albania" },
+	{ "AM", "AMD", "Armenia" },
+	{ "AO", "AOA", "Angola" },
+	{ "AQ", "XCD", "Antarctica" },
+	{ "AR", "ARS", "Argentina" },
+	{ "AS", "USD", "American Samoa" },
+	{ "AT", "EUR", "Austria" },
+	{ "AU", "AUD", "Australia" },
+	{ "AW", "AWG", "Aruba" },
+	{ "AX", "EUR", "Aland Islands" },
+	{ "AZ", "AZN", "Azerbaijan" },
+	{ "BA", "BAM", "Bosnia and Herzegovina" },
+	{ "BB", "BBD", "Barbados" },
+	{ "BD", "BDT", "Bangladesh" },
+	{ "BE", "EUR", "Belgium" },
+	{ "BF", "XOF", "Burkina Faso" },
+	{ "BG", "BGN", "Bulgaria" },
+	{ "BH", "BHD", "Bahrain" },
+	{ "BI", "BIF", "Burundi" },
+	{ "BJ", "XOF", "Benin" },
+	{ "BL", "EUR", "Saint Barthelemy" },
+	{ "BM", "BMD", "Bermuda" },
+	{ "BN", "BND", "Brunei" },
+	{ "BO", "BOB", "Bolivia" },
+	{ "BQ", "USD", "Caribbean Netherlands" },
+	{ "BR", "BRL", "Brazil" },
+	{ "BS", "BSD", "The Bahamas" },
+	{ "BT", "BTN", "Bhutan" },
+	{ "BV", "NOK", "Bouvet Island" },
+	{ "BW", "BWP", "Botswana" },
+	{ "BY", "BYN", "Belarus" },
+	{ "BZ", "BZD", "Belize" },
+	{ "CA", "CAD", "Canada" },
+	{ "CC", "AUD", "Cocos (Keeling) Islands" },
+	{ "CD", "CDF", "Democratic Republic of the Congo" },
+	{ "CF", "XAF", "Central African Republic" },
+	{ "CG", "XAF", "Republic of the Congo" },
+	{ "CH", "CHF", "Switzerland" },
+	{ "CI", "XOF", "Cote d'Ivoire" },
+	{ "CK", "NZD", "Cook Islands" },
+	{ "CL", "CLP", "Chile" },
+	{ "CM", "XAF", "Cameroon" },
+	{ "CN", "CNY", "China" },
+	{ "CO", "COP", "Colombia" },
+	{ "CR", "CRC", "Costa Rica" },
+	{ "CU", "CUP", "Cuba" },
+	{ "CV", "CVE", "Cape Verde" },
+	{ "CW", "ANG", "Curacao" },
+	{ "CX", "AUD", "Christmas Island" },
+	{ "CY", "EUR", "Cyprus" },
+	{ "CZ", "CZK", "Czechia" },
+	{ "DE", "EUR", "Germany" },
+	{ "DJ", "DJF", "Djibouti" },
+	{ "DK", "DKK", "Denmark" },
+	{ "DM", "XCD", "Dominica" },
+	{ "DO", "DOP", "Dominican Republic" },
+	{ "DZ", "DZD", "Algeria" },
+	{ "EC", "USD", "Ecuador" },
+	{ "EE", "EUR", "Estonia" },
+	{ "EG", "EGP", "Egypt" },
+	{ "EH", "MAD", "Western Sahara" },
+	{ "ER", "ERN", "Eritrea" },
+	{ "ES", "EUR", "Spain" },
+	{ "ET", "ETB", "Ethiopia" },
+	{ "FI", "EUR", "Finland" },
+	{ "FJ", "FJD", "Fiji" },
+	{ "FK", "FKP", "Falkland Islands (Islas Malvinas)" },
+	{ "FM", "USD", "Federated States of Micronesia" },
+	{ "FO", "DKK", "Faroe Islands" },
+	{ "FR", "EUR", "France" },
+	{ "GA", "XAF", "Gabon" },
+	{ "GB", "GBP", "United Kingdom" },
+	{ "GD", "XCD", "Grenada" },
+	{ "GE", "GEL", "Georgia" },
+	{ "GF", "EUR", "French Guiana" },
+	{ "GG", "GGP", "Guernsey" },
+	{ "GH", "GHS", "Ghana" },
+	{ "GI", "GIP", "Gibraltar" },
+	{ "GL", "DKK", "Greenland" },
+	{ "GM", "GMD", "The Gambia" },
+	{ "GN", "GNF", "Guinea" },
+	{ "GP", "EUR", "Guadeloupe" },
+	{ "GQ", "XAF", "Equatorial Guinea" },
+	{ "GR", "EUR", "Greece" },
+	{ "GS", "FKP", "South Georgia and the South Sandwich Islands" },
+	{ "GT", "GTQ", "Guatemala" },
+	{ "GU", "USD", "Guam" },
+	{ "GW", "XOF", "Guinea-Bissau" },
+	{ "GY", "GYD", "Guyana" },
+	{ "HK", "HKD", "Hong Kong" },
+	{ "HM", "AUD", "Heard Island and McDonald Islands" },
+	{ "HN", "HNL", "Honduras" },
+	{ "HR", "EUR", "Croatia" },
+	{ "HT", "HTG", "Haiti" },
+	{ "HU", "HUF", "Hungary" },
+	{ "ID", "IDR", "Indonesia" },
+	{ "IE", "EUR", "Ireland" },
+	{ "IL", "ILS", "Israel" },
+	{ "IM", "IMP", "Isle of Man" },
+	{ "IN", "INR", "India" },
+	{ "IO", "GBP", "British Indian Ocean Territory" },
+	{ "IQ", "IQD", "Iraq" },
+	{ "IR", "IRR", "Iran" },
+	{ "IS", "ISK", "Iceland" },
+	{ "IT", "EUR", "Italy" },
+	{ "JE", "JEP", "Jersey" },
+	{ "JM", "JMD", "Jamaica" },
+	{ "JO", "JOD", "Jordan" },
+	{ "JP", "JPY", "Japan" },
+	{ "KE", "KES", "Kenya" },
+	{ "KG", "KGS", "Kyrgyzstan" },
+	{ "KH", "KHR", "Cambodia" },
+	{ "KI", "AUD", "Kiribati" },
+	{ "KM", "KMF", "Comoros" },
+	{ "KN", "XCD", "Saint Kitts and Nevis" },
+	{ "KP", "KPW", "North Korea" },
+	{ "KR", "KRW", "South Korea" },
+	{ "KW", "KWD", "Kuwait" },
+	{ "KY", "KYD", "Cayman Islands" },
+	{ "KZ", "KZT", "Kazakhstan" },
+	{ "LA", "LAK", "Laos" },
+	{ "LB", "LBP", "Lebanon" },
+	{ "LC", "XCD", "Saint Lucia" },
+	{ "LI", "CHF", "Liechtenstein" },
+	{ "LK", "LKR", "Sri Lanka" },
+	{ "LR", "LRD", "Liberia" },
+	{ "LS", "LSL", "Lesotho" },
+	{ "LT", "EUR", "Lithuania" },
+	{ "LU", "EUR", "Luxembourg" },
+	{ "LV", "EUR", "Latvia" },
+	{ "LY", "LYD", "Libya" },
+	{ "MA", "MAD", "Morocco" },
+	{ "MC", "EUR", "Monaco" },
+	{ "MD", "MDL", "Moldova" },
+	{ "ME", "EUR", "Montenegro" },
+	{ "MF", "EUR", "Saint Martin" },
+	{ "MG", "MGA", "Madagascar" },
+	{ "MH", "USD", "Marshall Islands" },
+	{ "MK", "MKD", "North Macedonia" },
+	{ "ML", "XOF", "Mali" },
+	{ "MM", "MMK", "Myanmar (Burma)" },
+	{ "MN", "MNT", "Mongolia" },
+	{ "MO", "MOP", "Macau" },
+	{ "MP", "USD", "Northern Mariana Islands" },
+	{ "MQ", "EUR", "Martinique" },
+	{ "MR", "MRU", "Mauritania" },
+	{ "MS", "XCD", "Montserrat" },
+	{ "MT", "EUR", "Malta" },
+	{ "MU", "MUR", "Mauritius" },
+	{ "MV", "MVR", "Maldives" },
+	{ "MW", "MWK", "Malawi" },
+	{ "MX", "MXN", "Mexico" },
+	{ "MY", "MYR", "Malaysia" },
+	{ "MZ", "MZN", "Mozambique" },
+	{ "NA", "NAD", "Namibia" },
+	{ "NC", "XPF", "New Caledonia" },
+	{ "NE", "XOF", "Niger" },
+	{ "NF", "AUD", "Norfolk Island" },
+	{ "NG", "NGN", "Nigeria" },
+	{ "NI", "NIO", "Nicaragua" },
+	{ "NL", "EUR", "Netherlands" },
+	{ "NO", "NOK", "Norway" },
+	{ "NP", "NPR", "Nepal" },
+	{ "NR", "AUD", "Nauru" },
+	{ "NU", "NZD", "Niue" },
+	{ "NZ", "NZD", "New Zealand" },
+	{ "OM", "OMR", "Oman" },
+	{ "PA", "PAB", "Panama" },
+	{ "PE", "PEN", "Peru" },
+	{ "PF", "XPF", "French Polynesia" },
+	{ "PG", "PGK", "Papua New Guinea" },
+	{ "PH", "PHP", "Philippines" },
+	{ "PK", "PKR", "Pakistan" },
+	{ "PL", "PLN", "Poland" },
+	{ "PM", "EUR", "Saint Pierre and Miquelon" },
+	{ "PN", "NZD", "Pitcairn Islands" },
+	{ "PR", "USD", "Puerto Rico" },
+	{ "PS", "ILS", "Palestinian Territories" },
+	{ "PT", "EUR", "Portugal" },
+	{ "PW", "USD", "Palau" },
+	{ "PY", "PYG", "Paraguay" },
+	{ "QA", "QAR", "Qatar" },
+	{ "RE", "EUR", "Reunion" },
+	{ "RO", "RON", "Romania" },
+	{ "RS", "RSD", "Serbia" },
+	{ "RU", "RUB", "Russia" },
+	{ "RW", "RWF", "Rwanda" },
+	{ "SA", "SAR", "Saudi Arabia" },
+	{ "SB", "SBD", "Solomon Islands" },
+	{ "SC", "SCR", "Seychelles" },
+	{ "SD", "SDG", "Sudan" },
+	{ "SE", "SEK", "Sweden" },
+	{ "SG", "SGD", "Singapore" },
+	{ "SH", "SHP", "Saint Helena, Ascension and Tristan da Cunha" },
+	{ "SI", "EUR", "Slovenia" },
+	{ "SJ", "NOK", "Svalbard and Jan Mayen" },
+	{ "SK", "EUR", "Slovakia" },
+	{ "SL", "SLL", "Sierra Leone" },
+	{ "SM", "EUR", "San Marino" },
+	{ "SN", "XOF", "Senegal" },
+	{ "SO", "SOS", "Somalia" },
+	{ "SR", "SRD", "Suriname" },
+	{ "SS", "SSP", "South Sudan" },
+	{ "ST", "STN", "Sao Tome and Principe" },
+	{ "SV", "SVC", "El Salvador" },
+	{ "SX", "ANG", "Sint Maarten" },
+	{ "SY", "SYP", "Syria" },
+	{ "SZ", "SZL", "Eswatini" },
+	{ "TC", "USD", "Turks and Caicos Islands" },
+	{ "TD", "XAF", "Chad" },
+	{ "TF", "EUR", "French Southern and Antarctic Lands" },
+	{ "TG", "XOF", "Togo" },
+	{ "TH", "THB", "Thailand" },
+	{ "TJ", "TJS", "Tajikistan" },
+	{ "TK", "NZD", "Tokelau" },
+	{ "TL", "USD", "Timor-Leste" },
+	{ "TM", "TMT", "Turkmenistan" },
+	{ "TN", "TND", "Tunisia" },
+	{ "TO", "TOP", "Tonga" },
+	{ "TR", "TRY", "Turkey" },
+	{ "TT", "TTD", "Trinidad and Tobago" },
+	{ "TV", "AUD", "Tuvalu" },
+	{ "TW", "TWD", "Taiwan" },
+	{ "TZ", "TZS", "Tanzania" },
+	{ "UA", "UAH", "Ukraine" },
+	{ "UG", "UGX", "Uganda" },
+	{ "UM", "USD", "United States Minor Outlying Islands" },
+	{ "US", "USD", "United States" },
+	{ "UY", "UYU", "Uruguay" },
+	{ "UZ", "UZS", "Uzbekistan" },
+	{ "VA", "EUR", "Vatican City" },
+	{ "VC", "XCD", "Saint Vincent and the Grenadines" },
+	{ "VE", "VES", "Venezuela" },
+	{ "VG", "USD", "British Virgin Islands" },
+	{ "VI", "USD", "U.S. Virgin Islands" },
+	{ "VN", "VND", "Vietnam" },
+	{ "VU", "VUV", "Vanuatu" },
+	{ "WF", "XPF", "Wallis and Futuna" },
+	{ "WS", "WST", "Samoa" },
+	{ "XK", "EUR", "Kosovo" },
+	{ "YE", "YER", "Yemen" },
+	{ "YT", "EUR", "Mayotte" },
+	{ "ZA", "ZAR", "South Africa" },
+	{ "ZM", "ZMW", "Zambia" },
+	{ "ZW", "ZWL", "Zimbabwe" }
+} };
+
+static_assert(std::is_sorted(countries.begin(), countries.end(),
+	[](const country_info &a, const country_info &b) { return std::string_view{ a.code } < std::string_view{ b.code }; }));
+
+// The entry for a two-letter country code, or null
+inline const country_info *find_country(std::string_view code)
+{
+	const auto found{ std::lower_bound(countries.begin(), countries.end(), code,
+		[](const country_info &c, std::string_view code) { return std::string_view{ c.code } < code; }) };
+	return found != countries.end() && std::string_view{ found->code } == code ? &*found : nullptr;
+}
+
+#endif
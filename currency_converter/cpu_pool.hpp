@@ -0,0 +1,319 @@
+#ifndef CPU_POOL_H
+#define CPU_POOL_H
+
+#include "alloc_stats.hpp"
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+	A work-stealing thread pool for CPU-bound work, kept apart from the
+	threads that run the network I/O.
+
+	Rendering a template or converting a large chunk of CSV on an I/O thread
+	holds up every other connection waiting on that thread. Coroutines hand
+	such work to the pool with offload() instead, which suspends them until
+	the work is done and then resumes them on their own executor.
+
+	Each worker has its own deque, pinned to its own core where the platform
+	allows. Work submitted from outside the pool is dealt out round-robin;
+	a worker runs its newest task first, for cache locality, and an idle
+	worker steals the oldest task from another's deque before it sleeps.
+*/
+
+class cpu_pool
+{
+public:
+	// Counters for the diagnostics route
+	struct stats
+	{
+		std::size_t workers{ 0 };
+		std::size_t queued{ 0 };
+		std::size_t max_queued{ 0 };
+		std::uint64_t submitted{ 0 };
+		std::uint64_t executed{ 0 };
+		std::uint64_t stolen{ 0 };
+	};
+
+	// Starts threads workers; with none, offload() runs work inline
+	explicit cpu_pool(std::size_t threads)
+	{
+		const auto cores{ std::thread::hardware_concurrency() };
+		m_workers.reserve(threads);
+		for (std::size_t i{ 0 }; i != threads; ++i)
+		{
+			m_workers.push_back(std::make_unique<worker>());
+		}
+		m_threads.reserve(threads);
+		for (std::size_t i{ 0 }; i != threads; ++i)
+		{
+			m_threads.emplace_back([this, i] { run(i); });
+			if (threads <= cores)
+			{
+				pin(m_threads.back(), i);
+			}
+		}
+	}
+
+	~cpu_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_sleep_mutex };
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (auto &thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	cpu_pool(const cpu_pool &) = delete;
+	cpu_pool &operator=(const cpu_pool &) = delete;
+
+	std::size_t size() const
+	{
+		return m_workers.size();
+	}
+
+	// Queues a move-only callable; a worker submitting work keeps it
+	template<class Function>
+	void submit(Function &&f)
+	{
+		auto t{ std::make_unique<task_impl<std::decay_t<Function>>>(std::forward<Function>(f)) };
+		const auto index{ t_worker != nullptr && t_worker_pool == this ? t_worker_index
+			: m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size() };
+		{
+			auto &w{ *m_workers[index] };
+			std::lock_guard<std::mutex> lock{ w.mutex };
+			w.tasks.push_back(std::move(t));
+		}
+		m_submitted.fetch_add(1, std::memory_order_relaxed);
+		const auto queued{ m_queued.fetch_add(1) + 1 };
+		auto max{ m_max_queued.load(std::memory_order_relaxed) };
+		while (queued > max && !m_max_queued.compare_exchange_weak(max, queued, std::memory_order_relaxed))
+		{
+		}
+		if (m_sleeping.load() != 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_sleep_mutex };
+			}
+			m_wake.notify_one();
+		}
+	}
+
+	stats snapshot() const
+	{
+		stats s{ m_workers.size(), m_queued.load(std::memory_order_relaxed), m_max_queued.load(std::memory_order_relaxed),
+			m_submitted.load(std::memory_order_relaxed) };
+		for (const auto &w : m_workers)
+		{
+			s.executed += w->executed.load(std::memory_order_relaxed);
+			s.stolen += w->stolen.load(std::memory_order_relaxed);
+		}
+		return s;
+	}
+
+private:
+	struct task
+	{
+		virtual ~task() = default;
+		virtual void run() = 0;
+	};
+
+	template<class Function>
+	struct task_impl final : task
+	{
+		explicit task_impl(Function f)
+			: f{ std::move(f) }
+		{
+		}
+
+		void run() override
+		{
+			f();
+		}
+
+		Function f;
+	};
+
+	struct alignas(64) worker
+	{
+		std::mutex mutex;
+		std::deque<std::unique_ptr<task>> tasks;
+		std::atomic<std::uint64_t> executed{ 0 };
+		std::atomic<std::uint64_t> stolen{ 0 };
+	};
+
+	static inline thread_local worker *t_worker{ nullptr };
+	static inline thread_local const cpu_pool *t_worker_pool{ nullptr };
+	static inline thread_local std::size_t t_worker_index{ 0 };
+
+	static void pin([[maybe_unused]] std::thread &thread, [[maybe_unused]] std::size_t core)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof set, &set);
+#elif defined(_WIN32)
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR{ 1 } << core);
+#endif
+	}
+
+	// The newest task of this worker's own, or the oldest of another's
+	std::unique_ptr<task> next(std::size_t self)
+	{
+		{
+			auto &own{ *m_workers[self] };
+			std::lock_guard<std::mutex> lock{ own.mutex };
+			if (!own.tasks.empty())
+			{
+				auto t{ std::move(own.tasks.back()) };
+				own.tasks.pop_back();
+				return t;
+			}
+		}
+		for (std::size_t i{ 1 }; i != m_workers.size(); ++i)
+		{
+			auto &victim{ *m_workers[(self + i) % m_workers.size()] };
+			std::lock_guard<std::mutex> lock{ victim.mutex };
+			if (!victim.tasks.empty())
+			{
+				auto t{ std::move(victim.tasks.front()) };
+				victim.tasks.pop_front();
+				m_workers[self]->stolen.fetch_add(1, std::memory_order_relaxed);
+				return t;
+			}
+		}
+		return nullptr;
+	}
+
+	void run(std::size_t self)
+	{
+		t_worker = m_workers[self].get();
+		t_worker_pool = this;
+		t_worker_index = self;
+		for (;;)
+		{
+			if (auto t{ next(self) })
+			{
+				m_queued.fetch_sub(1, std::memory_order_relaxed);
+				t->run();
+				m_workers[self]->executed.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			// Sleep until work is submitted; the count of sleepers tells
+			// submit() whether it has to take the lock to wake one
+			std::unique_lock<std::mutex> lock{ m_sleep_mutex };
+			m_sleeping.fetch_add(1);
+			m_wake.wait(lock, [this] { return m_stopping || m_queued.load() != 0; });
+			m_sleeping.fetch_sub(1);
+			if (m_stopping)
+			{
+				return;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<worker>> m_workers;
+	std::vector<std::thread> m_threads;
+	std::atomic<std::size_t> m_next{ 0 };
+	std::atomic<std::size_t> m_queued{ 0 };
+	std::atomic<std::size_t> m_max_queued{ 0 };
+	std::atomic<std::uint64_t> m_submitted{ 0 };
+	std::atomic<std::size_t> m_sleeping{ 0 };
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_wake;
+	bool m_stopping{ false };
+};
+
+// Runs f on the CPU pool and resumes the calling coroutine on its own
+// executor with f's result, or with what f threw. The caller's allocation
+// tag goes with the work. f's result has to be default constructible.
+template<class Function>
+boost::asio::awaitable<std::invoke_result_t<Function>> offload(cpu_pool &pool, Function f)
+{
+	using result = std::invoke_result_t<Function>;
+	if (pool.size() == 0)
+	{
+		co_return f();
+	}
+
+	const auto tag{ alloc_stats::current() };
+	const alloc_stats::suspension suspended;
+	const auto initiate = [&pool, &f, tag](auto handler)
+	{
+		auto work{ boost::asio::make_work_guard(boost::asio::get_associated_executor(handler)) };
+		pool.submit([handler = std::move(handler), work = std::move(work), f = std::move(f), tag]() mutable
+			{
+				std::exception_ptr e;
+				[[maybe_unused]] std::conditional_t<std::is_void_v<result>, int, result> value{};
+				try
+				{
+					const alloc_stats::scope accounting{ tag };
+					if constexpr (std::is_void_v<result>)
+					{
+						f();
+					}
+					else
+					{
+						value = f();
+					}
+				}
+				catch (...)
+				{
+					e = std::current_exception();
+				}
+				const auto executor{ work.get_executor() };
+				boost::asio::post(executor, [handler = std::move(handler), e, value = std::move(value)]() mutable
+					{
+						if constexpr (std::is_void_v<result>)
+						{
+							std::move(handler)(e);
+						}
+						else
+						{
+							std::move(handler)(e, std::move(value));
+						}
+					});
+				work.reset();
+			});
+	};
+	if constexpr (std::is_void_v<result>)
+	{
+		co_return co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<> &, void(std::exception_ptr)>(
+			initiate, boost::asio::use_awaitable);
+	}
+	else
+	{
+		co_return co_await boost::asio::async_initiate<const boost::asio::use_awaitable_t<> &, void(std::exception_ptr, result)>(
+			initiate, boost::asio::use_awaitable);
+	}
+}
+
+#endif
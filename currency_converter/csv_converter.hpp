@@ -0,0 +1,182 @@
+#ifndef CSV_CONVERTER_H
+#define CSV_CONVERTER_H
+
+#include "rates.hpp"
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*
+	Converts an uploaded CSV ledger one chunk at a time.
+
+	Input rows are "amount,from,to" with an optional fourth column holding a
+	timestamp, which is accepted but not used: every row of an upload is
+	converted against the one rate snapshot the converter was created with.
+	Output rows are "amount,from,to,result,error" where exactly one of result
+	and error is filled in. Only an incomplete last line is carried between
+	chunks, and lines longer than max_line are rejected rather than buffered,
+	so memory use is the same whatever the size of the upload.
+*/
+
+class csv_converter
+{
+public:
+	// The first line of every response
+	static constexpr std::string_view header{ "amount,from,to,result,error\r\n" };
+
+	// Longest input line accepted
+	static constexpr std::size_t max_line = 1024;
+
+	explicit csv_converter(std::shared_ptr<const rate_snapshot> rates)
+		: m_rates{ std::move(rates) }
+	{
+		m_partial.reserve(max_line);
+	}
+
+	// Converts every complete line in chunk, appending the results to out;
+	// an incomplete last line is kept for the next call
+	void feed(std::string_view chunk, std::string &out)
+	{
+		while (!chunk.empty())
+		{
+			const auto newline{ chunk.find('\n') };
+			const auto piece{ chunk.substr(0, newline) };
+			if (newline == std::string_view::npos)
+			{
+				keep(piece);
+				return;
+			}
+			if (m_partial.empty() && !m_overlong)
+			{
+				m_overlong = piece.size() > max_line;
+				convert(piece, out);
+			}
+			else
+			{
+				keep(piece);
+				convert(m_partial, out);
+				m_partial.clear();
+			}
+			m_overlong = false;
+			chunk.remove_prefix(newline + 1);
+		}
+	}
+
+	// Converts a last line that had no line break after it
+	void finish(std::string &out)
+	{
+		if (!m_partial.empty() || m_overlong)
+		{
+			convert(m_partial, out);
+			m_partial.clear();
+			m_overlong = false;
+		}
+	}
+
+	// Input rows seen so far, not counting blank lines or a header row
+	std::uint64_t rows() const
+	{
+		return m_rows;
+	}
+
+private:
+	void keep(std::string_view piece)
+	{
+		if (m_partial.size() + piece.size() > max_line)
+		{
+			m_overlong = true;
+			m_partial.clear();
+			return;
+		}
+		if (!m_overlong)
+		{
+			m_partial.append(piece);
+		}
+	}
+
+	static std::string_view trim(std::string_view field)
+	{
+		while (!field.empty() && (field.front() == ' ' || field.front() == '\t' || field.front() == '"'))
+		{
+			field.remove_prefix(1);
+		}
+		while (!field.empty() && (field.back() == ' ' || field.back() == '\t' || field.back() == '"' || field.back() == '\r'))
+		{
+			field.remove_suffix(1);
+		}
+		return field;
+	}
+
+	// Splits off the field before the next comma
+	static std::string_view next_field(std::string_view &line)
+	{
+		const auto comma{ line.find(',') };
+		const auto field{ line.substr(0, comma) };
+		line = comma == std::string_view::npos ? std::string_view{} : line.substr(comma + 1);
+		return trim(field);
+	}
+
+	static void row(std::string &out, std::string_view amount, std::string_view from, std::string_view to,
+		std::string_view result, std::string_view error)
+	{
+		out.append(amount).append(1, ',').append(from).append(1, ',').append(to).append(1, ',');
+		out.append(result).append(1, ',').append(error).append("\r\n");
+	}
+
+	void convert(std::string_view line, std::string &out)
+	{
+		if (!m_overlong && trim(line).empty())
+		{
+			return;
+		}
+		const bool first{ m_first };
+		m_first = false;
+		if (m_overlong)
+		{
+			++m_rows;
+			return row(out, {}, {}, {}, {}, "line too long");
+		}
+
+		const auto amount_field{ next_field(line) };
+		const auto from{ next_field(line) };
+		const auto to{ next_field(line) };
+
+		double amount{ 0.0 };
+		const auto parsed{ std::from_chars(amount_field.data(), amount_field.data() + amount_field.size(), amount) };
+		if (parsed.ec != std::errc{} || parsed.ptr != amount_field.data() + amount_field.size())
+		{
+			// A first line that doesn't start with a number is a header row
+			if (first)
+			{
+				return;
+			}
+			++m_rows;
+			return row(out, amount_field, from, to, {}, "invalid amount");
+		}
+		++m_rows;
+
+		const auto from_index{ m_rates->index_of(from) };
+		const auto to_index{ m_rates->index_of(to) };
+		if (!from_index || !to_index || m_rates->rates[*from_index] == 0.0)
+		{
+			return row(out, amount_field, from, to, {}, "unknown currency");
+		}
+
+		std::array<char, 32> result;
+		const auto written{ std::to_chars(result.data(), result.data() + result.size(),
+			amount * m_rates->cross(*from_index, *to_index)) };
+		row(out, amount_field, from, to, std::string_view{ result.data(), static_cast<std::size_t>(written.ptr - result.data()) }, {});
+	}
+
+	std::shared_ptr<const rate_snapshot> m_rates;
+	std::string m_partial;
+	bool m_overlong{ false };
+	bool m_first{ true };
+	std::uint64_t m_rows{ 0 };
+};
+
+#endif
@@ -7,9 +7,9 @@
 // the form. By default, the base currency is USD and the resulting currency is the currency used at the place that the info window is 
 // opened on.
 
-// Google's Geocoder and Reverse Geocoding Service returns status "ZERO_RESULTS" for Western Sahara, Wake Island, and Kosovo. The second
-// dropdown menu switches to AED in that situation. The status means that there are no results to show even though reverse 
-// geocodng did work.
+// The currency at the info window's location is found by this server from country boundaries loaded at startup (see
+// geo.hpp and countries.hpp), rather than by Google's Reverse Geocoding Service, which returned "ZERO_RESULTS" for Western
+// Sahara, Wake Island and Kosovo.
 
 // This C++ application is the web server for the application. It acts as both a server and a client, as it also has to query 
 // the currency API, at openexchangerates.org on its currency conversion endpoint and get the conversion result to return 
@@ -20,14 +20,40 @@
 
 #include "server_certificate.hpp"
 #include "root_certificate.hpp"
-
+#include "logger.hpp"
+#include "trace.hpp"
+#include "rates.hpp"
+#include "csv_converter.hpp"
+#include "http2.hpp"
+#include "rate_limit.hpp"
+#include "static_assets.hpp"
+#include "geo.hpp"
+#include "capture.hpp"
+#include "alloc_stats.hpp"
+#include "cpu_pool.hpp"
+#include "handoff.hpp"
+
+#include <utility>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/asio/ssl/error.hpp>
-#include <boost/asio/connect.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/read.hpp>
+#if !defined(_WIN32)
+#include <boost/asio/local/stream_protocol.hpp>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 #include <jinja2cpp/template.h>
 #include <jinja2cpp/value.h>
 #include <jinja2cpp/template_env.h>
@@ -39,15 +65,46 @@
 #include <cctype>
 #include <iostream>
 #include <vector>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <optional>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;			// from <nlohmann/json.hpp>
 using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 namespace ssl = boost::asio::ssl;       // from <boost/asio/ssl.hpp>
 namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+using boost::asio::awaitable;           // from <boost/asio/awaitable.hpp>
+using boost::asio::use_awaitable;       // from <boost/asio/use_awaitable.hpp>
+using ssl_stream = boost::beast::ssl_stream<boost::beast::tcp_stream>;  // from <boost/beast/ssl.hpp>
+#if !defined(_WIN32)
+using unix_socket = boost::asio::local::stream_protocol;  // from <boost/asio/local/stream_protocol.hpp>
+#endif
+
+// Deadline for each read, write or handshake on a client connection
+constexpr std::chrono::seconds session_timeout{ 30 };
+
+// Deadline for each connect, handshake, write or read against the currency API
+constexpr std::chrono::seconds upstream_timeout{ 10 };
+
+// Size of the chunks upstream response bodies are read in
+constexpr std::size_t upstream_chunk_size{ 4096 };
+
+// Size of the chunks CSV uploads are read in, and of the chunks results are sent in
+constexpr std::size_t csv_chunk_size{ 16384 };
+
+// Largest request body read into memory (Beast's default); CSV uploads are streamed and have no limit
+constexpr std::uint64_t request_body_limit{ 1024 * 1024 };
 
 										//------------------------------------------------------------------------------
 
@@ -56,35 +113,221 @@ boost::beast::string_view mime_type(boost::beast::string_view path);
 
 // This class represents a cache for storing results from the
 // currency exchange API used by bankersalgo.com
+// Sessions only ever read the latest rate snapshot and currency list;
+// a background coroutine refreshes both, so no request waits on the API
 class cache_storage
 {
 public:
-	cache_storage(const std::chrono::seconds& duration)
-		: m_cache_conv{}, m_cache_list{}, m_duration{ duration }
+	cache_storage(std::string currencykey, std::uint32_t monthly_quota)
+		: m_currencykey{ std::move(currencykey) }, m_schedule{ monthly_quota, std::chrono::hours{ 1 } },
+		m_ctx{ ssl::context::tlsv12_client }
+	{
+		// This holds the root certificate used for verification
+		load_root_certificates(m_ctx);
+
+		// Verify the remote server's certificate
+		m_ctx.set_verify_mode(ssl::verify_peer);
+	}
+
+	// The most recent rates, or null until the first refresh completes
+	std::shared_ptr<const rate_snapshot> rates() const
+	{
+		return m_rates.load();
+	}
+
+	// The most recent currency list (JSON as sent by the API), or null
+	// until the first refresh completes
+	std::shared_ptr<const std::string> currency_list() const
+	{
+		return m_list.load();
+	}
+
+	// Keeps the rates and the currency list up to date for as long as the
+	// io_context runs. Stale data keeps being served while a refresh is
+	// pending or failing. Must not be spawned more than once. Each new
+	// table is finished, and its cross rates computed, on the CPU pool.
+	awaitable<void> refresh(cpu_pool &cpu);
+
+	// Serves the given rates and currency list from now on, in place of
+	// refresh(); used to stub out the API when replaying a capture
+	void pin(std::shared_ptr<const rate_snapshot> rates, std::shared_ptr<const std::string> list)
+	{
+		m_rates.store(std::move(rates));
+		m_list.store(std::move(list));
+	}
+
+	// Starts from the rates and currency list of the server this one
+	// replaces, either of which may be null; refresh() then leaves them be
+	// until they are due. Must be called before refresh() is spawned.
+	void adopt(std::shared_ptr<const rate_snapshot> rates, std::shared_ptr<const std::string> list)
+	{
+		m_rates.store(std::move(rates));
+		if (list)
+		{
+			m_list.store(std::move(list));
+			m_list_fetched = std::chrono::steady_clock::now();
+		}
+	}
+
+private:
+	// Sends a GET request for target to the currency API and passes the response
+	// body to on_data a chunk at a time, as it arrives
+	// The coroutine suspends on every network operation, so no thread waits on the API
+	template<class DataHandler>
+	awaitable<void> fetch(const std::string &target, const trace::context &tctx, DataHandler on_data);
+
+	// Asks the API how much of this month's quota is already used
+	awaitable<void> query_usage();
+
+	const std::string m_currencykey;
+
+	// Only touched by the refresh coroutine
+	refresh_schedule m_schedule;
+	std::chrono::steady_clock::time_point m_list_fetched{};
+
+	std::atomic<std::shared_ptr<const rate_snapshot>> m_rates;
+	std::atomic<std::shared_ptr<const std::string>> m_list;
+
+	// The SSL context for connections to the currency API
+	ssl::context m_ctx;
+};
+
+// The sessions waiting on their clients, so that a server that has handed
+// over its listener can close them instead of waiting for them to time out
+class idle_sessions
+{
+public:
+	// Registers a session until leave(); if the server starts draining
+	// before then, wake is called on the session's executor. Returns false,
+	// and registers nothing, once the server is draining.
+	bool enter(std::uint64_t id, boost::asio::any_io_executor executor, std::function<void()> wake)
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		if (m_draining)
+		{
+			return false;
+		}
+		m_entries[id] = { std::move(executor), std::move(wake) };
+		return true;
+	}
+
+	// Must be called on the session's executor, so that it can't run at
+	// the same time as the session's wake
+	void leave(std::uint64_t id)
 	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_entries.erase(id);
 	}
 
-	// This function queries the currency API after making sure
-	// that the stored result(s) is/are old enough
-	// It also makes a new query to the API if needed
-	const json& query_rate(std::string_view query_data, std::string_view currencykey, const json& sentry);
+	// Wakes every registered session and turns away new ones
+	void drain()
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		m_draining = true;
+		for (const auto &[id, entry] : m_entries)
+		{
+			boost::asio::post(entry.executor, [this, id = id] { wake(id); });
+		}
+	}
 
-	// This function queries the currency API for a list of currencies
-	const json& query_list(std::string_view currencykey, std::string_view mapkey, const json& sentry);
+	bool draining() const
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		return m_draining;
+	}
 
 private:
-	// The cache for the conversion rate result
-	std::map<std::tuple<std::string_view>, std::pair<std::chrono::time_point<std::chrono::steady_clock>, json>> m_cache_conv;
+	struct entry
+	{
+		boost::asio::any_io_executor executor;
+		std::function<void()> wake;
+	};
+
+	// Runs on the session's executor; a session that has left since is gone
+	void wake(std::uint64_t id)
+	{
+		std::function<void()> wake;
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			const auto found{ m_entries.find(id) };
+			if (found == m_entries.end())
+			{
+				return;
+			}
+			wake = std::move(found->second.wake);
+			m_entries.erase(found);
+		}
+		wake();
+	}
+
+	mutable std::mutex m_mutex;
+	std::map<std::uint64_t, entry> m_entries;
+	bool m_draining{ false };
+};
 
-	// The cache for the currency list
-	std::map<std::string_view, std::pair<std::chrono::time_point<std::chrono::steady_clock>, json>> m_cache_list;
+// Everything the sessions share: configuration, the rate cache, the per-client limits
+// and the threads for CPU-bound work
+struct shared_state
+{
+	shared_state(std::string doc_root, std::string googlekey, std::string currencykey, std::uint32_t monthly_quota,
+		const rate_limiter::limits &limits, bool cache_assets, country_locator locator, std::size_t cpu_threads)
+		: doc_root{ std::move(doc_root) }, googlekey{ std::move(googlekey) }, currencykey{ currencykey },
+		cache{ std::move(currencykey), monthly_quota }, limiter{ limits }, assets{ cache_assets },
+		locator{ std::move(locator) }, cpu{ cpu_threads }
+	{
+	}
 
-	std::chrono::seconds m_duration;
+	const std::string doc_root;
+	const std::string googlekey;
+	const std::string currencykey;
+	cache_storage cache;
+	rate_limiter limiter;
+	asset_cache assets;
+	const country_locator locator;
+
+	// Records every request when traffic is being captured, else null
+	std::unique_ptr<capture::recorder> recorder;
+
+	// Sessions still running, and those waiting on their clients. Once a
+	// newer server has taken over the listener, sessions close after the
+	// response in progress, and idle ones straight away.
+	std::atomic<std::size_t> sessions{ 0 };
+	idle_sessions idle;
+
+	// Last, so its threads stop before anything their work uses is destroyed
+	cpu_pool cpu;
 };
 
+// The route a request's allocations are counted against
+alloc_stats::route accounting_route(http::verb method, boost::beast::string_view target);
+
+// Takes a token for the client from the route class's bucket; returns 0 if
+// the request may go ahead, else the seconds to send in Retry-After
+std::uint32_t check_rate_limit(shared_state &state, const boost::asio::ip::address &remote, route_class what);
+
+// Adds a request to the capture file, if there is one; the rates and list
+// serving it are recorded along with it when they have changed
+template<class Fields>
+void capture_request(shared_state &state, const trace::context &tctx, const http::request_header<Fields> &header,
+	std::string_view body, bool body_omitted);
+
 // Parse POST body
 std::map<std::string, std::string> parse(std::string_view data);
 
+// The allocation counters of every route as JSON
+std::string alloc_stats_json();
+
+// Returns the value of a parameter in a request target's query string, or an empty view
+std::string_view query_value(std::string_view target, std::string_view name);
+
+// Reads a whole file into memory
+std::string read_file(const std::string &path, boost::beast::error_code &ec);
+
+// Reads the first rates and currency list recorded in a capture file;
+// throws std::runtime_error if it has none
+std::pair<std::shared_ptr<const rate_snapshot>, std::shared_ptr<const std::string>> load_captured_rates(
+	const std::string &path);
+
 // Append an HTTP rel-path to a local filesystem path.
 // The returned path is normalized for the platform.
 std::string path_cat(boost::beast::string_view base, boost::beast::string_view path);
@@ -93,15 +336,19 @@ std::string path_cat(boost::beast::string_view base, boost::beast::string_view p
 // request. The type of the response object depends on the
 // contents of the request, so the interface requires the
 // caller to pass a generic lambda for receiving the response.
+// Sending suspends the coroutine, as do any queries to the currency API.
 template<class Body, class Allocator, class Send>
-void handle_request(boost::beast::string_view doc_root, http::request<Body, http::basic_fields<Allocator>> &&req,
-	Send &&send, std::string_view googlekey, std::string_view currencykey);
+awaitable<void> handle_request(shared_state &state, http::request<Body, http::basic_fields<Allocator>> req,
+	Send &send, const boost::asio::ip::address &remote, const trace::context &tctx);
 
 //------------------------------------------------------------------------------
 
 // Report a failure
 void fail(boost::system::error_code ec, const char *what);
 
+// Completion handler for detached coroutines; logs what they threw
+void report_exception(std::exception_ptr e);
+
 // The function object is used to send an HTTP message.
 template<class Stream>
 struct send_lambda
@@ -109,28 +356,114 @@ struct send_lambda
 	Stream &stream_;
 	bool &close_;
 	boost::system::error_code &ec_;
+	const trace::context &tctx_;
 
-	explicit send_lambda(Stream &stream, bool &close, boost::system::error_code &ec)
-		: stream_{ stream }, close_{ close }, ec_{ ec }
+	explicit send_lambda(Stream &stream, bool &close, boost::system::error_code &ec, const trace::context &tctx)
+		: stream_{ stream }, close_{ close }, ec_{ ec }, tctx_{ tctx }
 	{
 	}
 
 	template<bool isRequest, class Body, class Fields>
-	void operator()(http::message<isRequest, Body, Fields> &&msg) const;
+	awaitable<void> operator()(http::message<isRequest, Body, Fields> msg) const;
+};
+
+// Streams the conversion of an uploaded CSV ledger: rows are converted as the
+// upload arrives, against a single rate snapshot, and the results are sent
+// back with chunked transfer encoding
+awaitable<void> convert_csv(ssl_stream &stream, boost::beast::flat_buffer &buffer,
+	http::request_parser<http::empty_body> &&header, shared_state &state, const boost::asio::ip::address &remote,
+	bool &close, boost::system::error_code &ec, const trace::context &tctx);
+
+#if defined(CURRENCY_CONVERTER_HTTP2)
+// An HTTP/2 connection, shared by the coroutine reading it and the
+// coroutines answering its streams
+struct http2_connection : std::enable_shared_from_this<http2_connection>
+{
+	http2_connection(ssl_stream &stream, shared_state &state, const boost::asio::ip::address &remote,
+		const trace::context &tctx);
+
+	// Starts a coroutine that answers a complete request
+	void on_request(std::int32_t stream_id, http2::request &&req);
+
+	// CSV uploads are converted as they stream in; other requests are read whole
+	std::optional<http2::streamed_response> route(const http2::request &req);
+
+	// Writes queued frames until there are none left. Only one coroutine
+	// writes at a time; the others return at once and leave it to that one.
+	awaitable<void> flush();
+
+	ssl_stream &stream;
+	shared_state &state;
+	const boost::asio::ip::address remote;
+	const trace::context tctx;
+	http2::session session;
+	boost::asio::steady_timer write_done;   // cancelled whenever a flush finishes
+	bool writing{ false };
+	bool open{ true };
+};
+
+// The function object used to send the response to an HTTP/2 stream
+struct http2_send
+{
+	std::shared_ptr<http2_connection> conn_;
+	std::int32_t stream_id_;
+	const trace::context &tctx_;
+
+	template<bool isRequest, class Body, class Fields>
+	awaitable<void> operator()(http::message<isRequest, Body, Fields> msg) const;
 };
 
+// Handles a connection that negotiated HTTP/2 until either side ends it
+awaitable<void> do_http2_session(ssl_stream &stream, shared_state &state, const boost::asio::ip::address &remote,
+	const trace::context &tctx);
+#endif
+
 // Handles an HTTP server connection
-void do_session(tcp::socket &socket, ssl::context &ctx, const std::string &doc_root, std::string_view googlekey,
-	std::string_view currencykey);
+awaitable<void> do_session(ssl_stream stream, shared_state &state, trace::context tctx);
+
+// Accepts incoming connections and spawns a session coroutine for each one
+awaitable<void> do_listen(tcp::acceptor &acceptor, ssl::context &ctx, shared_state &state);
+
+#if !defined(_WIN32)
+// Hands the listener and the cached rates to a newer server that connects to
+// the handoff socket, then stops accepting, drains the sessions and stops ioc
+awaitable<void> serve_handoff(unix_socket::acceptor &successors, tcp::acceptor &acceptor, shared_state &state,
+	boost::asio::io_context &ioc, std::chrono::seconds drain_deadline);
+#endif
+
+// Writes the recently traced spans to trace.json whenever SIGUSR1 arrives
+void watch_trace_signal(boost::asio::signal_set &signals);
 
 // Converts jinja2::ErrorInfo object to std::string
 std::string error_to_string(const jinja2::ErrorInfo &error);
 
+// Renders the index page template at path; throws std::runtime_error with
+// Jinja's message if it can't be rendered
+std::string render_index_page(const shared_state &state, const std::string &path);
+
 // Performs currency conversion calculation
 double calc_result(const double money_amount, const double conversion_rate);
 
+// Converts an amount of currency from into every currency, or the comma-separated
+// codes in to, as {"timestamp":...,"from":"EUR","amount":100,"to":[...],"results":[...]};
+// returns nothing if a code in to is unknown
+std::optional<std::string> convert_all(const rate_snapshot &rates, std::size_t from, double amount, std::string_view to);
+
 int main(int argc, char* argv[])
 {
+	// Drains log records on a background thread until main() returns
+	logging::scope log_scope;
+	if (const char *loglevel{ std::getenv("loglevel") })
+	{
+		logging::logger::instance().set_level(logging::parse_level(loglevel, logging::level::info));
+	}
+
+	// Trace one connection in every "tracesample" connections; unset means no tracing
+	if (const char *tracesample{ std::getenv("tracesample") })
+	{
+		trace::tracer::instance().set_sample_rate(static_cast<std::uint32_t>(std::strtoul(tracesample, nullptr, 10)));
+	}
+
 	try
 	{
 		// Check command line arguments.
@@ -145,49 +478,199 @@ int main(int argc, char* argv[])
 		const auto address{ boost::asio::ip::make_address(argv[1]) };
 		const auto port{ static_cast<unsigned short>(std::atoi(argv[2])) };
 		const auto doc_root{ std::string(argv[3]) };
+		const auto threads{ std::max(1u, std::thread::hardware_concurrency()) };
 
 		// The io_context is required for all I/O
-		boost::asio::io_context ioc{ 1 };
-		
+		boost::asio::io_context ioc{ static_cast<int>(threads) };
+
 		// The SSL context is required, and holds certificates
 		ssl::context ctx{ ssl::context::tlsv12_server };
 
 		// This holds the signed certificate used by the server
 		load_server_certificate(ctx);
 
+		// Clients can ask for HTTP/2 while the TLS handshake is done
+		http2::enable_alpn(ctx);
+
 		// Google API Key
 		std::string googlekey_str{ std::getenv("googlekey") };
-		std::string_view googlekey{ googlekey_str };
 
 		// Open Exchange Rates Currency API App ID/API key
 		std::string currencykey_str{ std::getenv("currencykey") };
-		std::string_view currencykey{ currencykey_str };
 
-		// The acceptor receives incoming connections
-		tcp::acceptor acceptor{ ioc, { address, port } };
-		std::cout << "Starting server at " << address << ':' << port << "...\n";
-		for (;;)
+		// Requests per month allowed by the currency API plan; the free plan's 1000 if unset.
+		// A quota of 0 would stop refreshing after the first fetch, so it's refused.
+		const char *currencyquota{ std::getenv("currencyquota") };
+		std::uint32_t monthly_quota{ 1000 };
+		if (currencyquota)
+		{
+			const std::string_view text{ currencyquota };
+			const auto [end, ec]{ std::from_chars(text.data(), text.data() + text.size(), monthly_quota) };
+			if (ec != std::errc{} || end != text.data() + text.size() || monthly_quota == 0)
+			{
+				throw std::runtime_error{ "currencyquota must be a positive integer, not " + std::string{ text } };
+			}
+		}
+
+		// Per-client request limits for each class of route, e.g. "convert=5/50,batch=0/0"
+		const char *ratelimit{ std::getenv("ratelimit") };
+		const auto limits{ ratelimit ? rate_limiter::parse(ratelimit) : rate_limiter::default_limits };
+
+		// Files are read from disk for every request if "staticcache" is "off"
+		const char *staticcache{ std::getenv("staticcache") };
+		const bool cache_assets{ !staticcache || std::string_view{ staticcache } != "off" };
+
+		// Country boundaries (GeoJSON) for finding the currency at a map location
+		country_locator locator;
+		if (const char *countryboundaries{ std::getenv("countryboundaries") })
+		{
+			locator = country_locator::load(countryboundaries);
+		}
+
+		// A server already running with the same "handoffsocket" hands over its
+		// listening socket and cached rates, then gives its sessions up to
+		// "draindeadline" seconds (30 if unset) to finish before it exits
+		const char *handoffsocket{ std::getenv("handoffsocket") };
+		const char *draindeadline{ std::getenv("draindeadline") };
+		const std::chrono::seconds drain_deadline{ draindeadline ? std::strtol(draindeadline, nullptr, 10) : 30 };
+
+		// Threads for CPU-bound work such as rendering and CSV conversion, one
+		// per core unless "cputhreads" says otherwise; 0 does the work inline
+		const char *cputhreads{ std::getenv("cputhreads") };
+		const auto cpu_threads{ cputhreads ? static_cast<std::size_t>(std::strtoul(cputhreads, nullptr, 10)) : std::size_t{ threads } };
+
+		shared_state state{ doc_root, googlekey_str, currencykey_str, monthly_quota, limits, cache_assets, std::move(locator),
+			cpu_threads };
+
+		// Requests are recorded to "capturefile" for the replay tool, with the
+		// digits in amounts and locations scrubbed unless "capturescrub" is "off"
+		if (const char *capturefile{ std::getenv("capturefile") })
+		{
+			const char *capturescrub{ std::getenv("capturescrub") };
+			state.recorder = std::make_unique<capture::recorder>(capturefile,
+				!capturescrub || std::string_view{ capturescrub } != "off");
+		}
+
+		// When replaying, "replayrates" names a capture file whose first rates
+		// and currency list are served instead of the API's
+		const char *replayrates{ std::getenv("replayrates") };
+		if (replayrates)
+		{
+			auto [rates, list]{ load_captured_rates(replayrates) };
+			state.cache.pin(std::move(rates), std::move(list));
+		}
+
+		// The acceptor receives incoming connections, on the previous server's
+		// listening socket if there is one to take over
+		tcp::acceptor acceptor{ ioc };
+#if !defined(_WIN32)
+		std::optional<unix_socket::socket> predecessor;
+		if (handoffsocket)
+		{
+			boost::system::error_code ec;
+			predecessor.emplace(ioc);
+			predecessor->connect(unix_socket::endpoint{ handoffsocket }, ec);
+			if (ec)
+			{
+				predecessor.reset();
+			}
+		}
+		if (predecessor)
+		{
+			auto inherited{ handoff::receive(predecessor->native_handle()) };
+
+			// The previous server may have been started on another address or
+			// port; taking over its socket would quietly serve there instead.
+			// Refusing leaves it running, as it never hears back.
+			const tcp::endpoint requested{ address, port };
+			tcp::endpoint bound;
+			sockaddr_storage name{};
+			socklen_t length{ sizeof name };
+			if (::getsockname(inherited.listener, reinterpret_cast<sockaddr *>(&name), &length) == 0 && length <= bound.capacity())
+			{
+				std::memcpy(bound.data(), &name, length);
+				bound.resize(length);
+			}
+			if (bound != requested)
+			{
+				::close(inherited.listener);
+				throw std::runtime_error{ "Inherited a listener on " + bound.address().to_string() + ":" +
+					std::to_string(bound.port()) + ", not " + requested.address().to_string() + ":" + std::to_string(requested.port()) };
+			}
+			acceptor.assign(bound.protocol(), inherited.listener);
+			logging::log(logging::event::took_over, inherited.rates ? inherited.rates->rates.size() : 0);
+			if (!replayrates)
+			{
+				state.cache.adopt(std::move(inherited.rates), std::move(inherited.list));
+			}
+		}
+		else
+#endif
+		{
+			acceptor = tcp::acceptor{ ioc, { address, port } };
+		}
+		logging::log(logging::event::server_start, address.to_string(), port);
+
+		// Accepting and handing off share a strand, so the acceptor is never
+		// closed while an accept on it is being started or completed
+		const auto listen_strand{ boost::asio::make_strand(ioc) };
+		boost::asio::co_spawn(listen_strand, do_listen(acceptor, ctx, state), report_exception);
+
+#if !defined(_WIN32)
+		// Only once this server is accepting does the previous one let go;
+		// then the handoff socket is this server's, for the next one
+		if (predecessor)
+		{
+			handoff::acknowledge(predecessor->native_handle());
+			predecessor.reset();
+		}
+		std::optional<unix_socket::acceptor> successors;
+		if (handoffsocket)
+		{
+			::unlink(handoffsocket);
+			successors.emplace(ioc, unix_socket::endpoint{ handoffsocket });
+			boost::asio::co_spawn(listen_strand, serve_handoff(*successors, acceptor, state, ioc, drain_deadline), report_exception);
+		}
+#endif
+		if (!replayrates)
 		{
-			// This will receive the new connection
-			tcp::socket socket{ ioc };
+			boost::asio::co_spawn(boost::asio::make_strand(ioc), state.cache.refresh(state.cpu), report_exception);
+		}
+
+		// Stop cleanly on Ctrl+C or a termination request
+		boost::asio::signal_set stop_signals{ ioc, SIGINT, SIGTERM };
+		stop_signals.async_wait([&ioc](const boost::system::error_code &, int)
+			{
+				ioc.stop();
+			});
 
-			// Block until we get a connection
-			acceptor.accept(socket);
+#if defined(SIGUSR1)
+		boost::asio::signal_set trace_signals{ ioc, SIGUSR1 };
+		watch_trace_signal(trace_signals);
+#endif
 
-			// Launch the session, transferring ownership of the socket
-			std::thread([=, socket = std::move(socket), &ctx]() mutable {
-				do_session(socket, ctx, doc_root, googlekey, currencykey);
-			}).detach();
+		// Sessions are coroutines, so a handful of threads serves every
+		// connection; the calling thread is one of them
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		for (auto i{ threads - 1 }; i > 0; --i)
+		{
+			workers.emplace_back([&ioc] { ioc.run(); });
+		}
+		ioc.run();
+		for (auto &worker : workers)
+		{
+			worker.join();
 		}
 	}
 	catch (const std::runtime_error &e)
 	{
-		std::cerr << "Line 185: Error: " << e.what() << '\n';
+		logging::log(logging::event::fatal_error, e.what());
 		return EXIT_FAILURE;
 	}
 	catch (const std::exception &e)
 	{
-		std::cerr << "Line 190: Error: " << e.what() << '\n';
+		logging::log(logging::event::fatal_error, e.what());
 		return EXIT_FAILURE + 1;
 	}
 }
@@ -292,6 +775,36 @@ boost::beast::string_view mime_type(boost::beast::string_view path)
 	return "application/text";
 }
 
+// Reads a whole file into memory
+std::string read_file(const std::string &path, boost::beast::error_code &ec)
+{
+	std::string content;
+	boost::beast::file file;
+	file.open(path.c_str(), boost::beast::file_mode::scan, ec);
+	if (ec)
+	{
+		return content;
+	}
+	const auto size{ file.size(ec) };
+	if (ec)
+	{
+		return content;
+	}
+	content.resize(static_cast<std::size_t>(size));
+	std::size_t read{ 0 };
+	while (read < content.size() && !ec)
+	{
+		const auto n{ file.read(content.data() + read, content.size() - read, ec) };
+		if (n == 0)
+		{
+			break;
+		}
+		read += n;
+	}
+	content.resize(read);
+	return content;
+}
+
 // Append an HTTP rel-path to a local filesystem path.
 // The returned path is normalized for the platform.
 std::string path_cat(boost::beast::string_view base, boost::beast::string_view path)
@@ -391,13 +904,31 @@ std::map<std::string, std::string> parse(std::string_view data)
 	return parsed_values;
 }
 
+// Returns the value of a parameter in a request target's query string, or an empty view
+std::string_view query_value(std::string_view target, std::string_view name)
+{
+	auto query{ target.substr(std::min(target.find('?'), target.size())) };
+	while (!query.empty())
+	{
+		query.remove_prefix(1);
+		const auto end{ std::min(query.find('&'), query.size()) };
+		const auto param{ query.substr(0, end) };
+		if (param.size() > name.size() && param.substr(0, name.size()) == name && param[name.size()] == '=')
+		{
+			return param.substr(name.size() + 1);
+		}
+		query.remove_prefix(end);
+	}
+	return {};
+}
+
 // This function produces an HTTP response for the given
 // request. The type of the response object depends on the
 // contents of the request, so the interface requires the
 // caller to pass a generic lambda for receiving the response.
 template<class Body, class Allocator, class Send>
-void handle_request(boost::beast::string_view doc_root, http::request<Body, http::basic_fields<Allocator>> &&req,
-	Send &&send, std::string_view googlekey, std::string_view currencykey)
+awaitable<void> handle_request(shared_state &state, http::request<Body, http::basic_fields<Allocator>> req,
+	Send &send, const boost::asio::ip::address &remote, const trace::context &tctx)
 {
 	// Returns a bad request response
 	const auto bad_request = [&req](boost::beast::string_view why)
@@ -423,6 +954,32 @@ void handle_request(boost::beast::string_view doc_root, http::request<Body, http
 		return res;
 	};
 
+	// Returns a service unavailable response, used before the first rates arrive
+	const auto service_unavailable = [&req](boost::beast::string_view what)
+	{
+		http::response<http::string_body> res{ http::status::service_unavailable, req.version() };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/html");
+		res.set(http::field::retry_after, "5");
+		res.keep_alive(req.keep_alive());
+		res.body() = what.to_string();
+		res.prepare_payload();
+		return res;
+	};
+
+	// Returns a too many requests response for a client over its limit
+	const auto too_many_requests = [&req](std::uint32_t retry_after)
+	{
+		http::response<http::string_body> res{ http::status::too_many_requests, req.version() };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/html");
+		res.set(http::field::retry_after, std::to_string(retry_after));
+		res.keep_alive(req.keep_alive());
+		res.body() = "Too many requests";
+		res.prepare_payload();
+		return res;
+	};
+
 	// Returns a server error response
 	const auto server_error = [&req](boost::beast::string_view what)
 	{
@@ -435,12 +992,25 @@ void handle_request(boost::beast::string_view doc_root, http::request<Body, http
 		return res;
 	};
 
+	// What's allocated while the request is answered is counted against its
+	// route; sending clears the tag while the coroutine is suspended
+	const auto accounted{ accounting_route(req.method(), req.target()) };
+	const alloc_stats::scope accounting{ accounted, alloc_stats::phase::handle };
+
+	// Clients over their limit for this kind of route are told when to come back
+	const auto what{ req.method() == http::verb::post || req.target().starts_with("/?q=convert_all&") ? route_class::convert
+		: req.target() == "/?q=currency_list" ? route_class::list : route_class::static_file };
+	if (const auto retry_after{ check_rate_limit(state, remote, what) })
+	{
+		co_return co_await send(too_many_requests(retry_after));
+	}
+
 	// Make sure we can handle the method
 	if (req.method() != http::verb::get &&
 		req.method() != http::verb::head &&
 		req.method() != http::verb::post)
 	{
-		return send(bad_request("Unknown HTTP-method"));
+		co_return co_await send(bad_request("Unknown HTTP-method"));
 	}
 
 	// Request path must be absolute and not contain "..".
@@ -448,87 +1018,283 @@ void handle_request(boost::beast::string_view doc_root, http::request<Body, http
 		req.target()[0] != '/' ||
 		req.target().find("..") != boost::beast::string_view::npos)
 	{
-		return send(bad_request("Illegal request-target"));
+		co_return co_await send(bad_request("Illegal request-target"));
 	}
 
-	// Build the path to the requested file
-	std::string path;
-	if (req.target() != "/?q=googlekey" && req.target() != "/?q=currency_list")
+	// Recent trace spans as Chrome trace-event JSON, for local callers only
+	if (req.target() == "/?q=trace" && req.method() == http::verb::get)
 	{
-		path = path_cat(doc_root, req.target());
-		if (req.target().back() == '/')
+		if (!remote.is_loopback())
 		{
-			path.append("index.html");
+			co_return co_await send(not_found(req.target()));
 		}
+		http::response<http::string_body> res{
+			std::piecewise_construct,
+			std::make_tuple(trace::tracer::instance().dump()),
+			std::make_tuple(http::status::ok, req.version()) };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		res.content_length(res.body().size());
+		res.keep_alive(req.keep_alive());
+		co_return co_await send(std::move(res));
 	}
 
-	// Attempt to open the file
-	boost::beast::error_code ec;
-	http::file_body::value_type body;
-	if (req.target() != "/" && req.target() != "/?q=currency_list" && req.target() != "/?q=googlekey")
+	// Queue depth and steals of the CPU pool, for local callers only
+	if (req.target() == "/?q=cpu_stats" && req.method() == http::verb::get)
 	{
-		body.open(path.c_str(), boost::beast::file_mode::scan, ec);
+		if (!remote.is_loopback())
+		{
+			co_return co_await send(not_found(req.target()));
+		}
+		const auto stats{ state.cpu.snapshot() };
+		const json body{ { "workers", stats.workers }, { "queued", stats.queued }, { "max_queued", stats.max_queued },
+			{ "submitted", stats.submitted }, { "executed", stats.executed }, { "stolen", stats.stolen } };
+		http::response<http::string_body> res{
+			std::piecewise_construct,
+			std::make_tuple(body.dump()),
+			std::make_tuple(http::status::ok, req.version()) };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		res.content_length(res.body().size());
+		res.keep_alive(req.keep_alive());
+		co_return co_await send(std::move(res));
 	}
 
-	// Handle the case where the file doesn't exist
-	if (ec == boost::system::errc::no_such_file_or_directory)
+	// Allocation counts, bytes and live memory by route and phase, for local callers only
+	if (req.target() == "/?q=alloc_stats" && req.method() == http::verb::get)
 	{
-		return send(not_found(req.target()));
+		if (!remote.is_loopback())
+		{
+			co_return co_await send(not_found(req.target()));
+		}
+		http::response<http::string_body> res{
+			std::piecewise_construct,
+			std::make_tuple(alloc_stats_json()),
+			std::make_tuple(http::status::ok, req.version()) };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		res.content_length(res.body().size());
+		res.keep_alive(req.keep_alive());
+		co_return co_await send(std::move(res));
 	}
 
-	// Handle an unknown error
-	if (ec)
+	// The country and currency at a map location, e.g. /?q=locate&lat=48.86&lng=2.35
+	if (req.target().starts_with("/?q=locate&") && req.method() == http::verb::get)
 	{
-		return send(server_error(ec.message()));
+		if (state.locator.empty())
+		{
+			co_return co_await send(service_unavailable("Country boundaries aren't loaded"));
+		}
+		const std::string_view target{ req.target().data(), req.target().size() };
+		const auto lat_text{ query_value(target, "lat") };
+		const auto lng_text{ query_value(target, "lng") };
+		double lat{ 0.0 }, lng{ 0.0 };
+		const auto lat_parsed{ std::from_chars(lat_text.data(), lat_text.data() + lat_text.size(), lat) };
+		const auto lng_parsed{ std::from_chars(lng_text.data(), lng_text.data() + lng_text.size(), lng) };
+		if (lat_parsed.ec != std::errc{} || lat_parsed.ptr != lat_text.data() + lat_text.size() ||
+			lng_parsed.ec != std::errc{} || lng_parsed.ptr != lng_text.data() + lng_text.size())
+		{
+			co_return co_await send(bad_request("Expected lat and lng"));
+		}
+		const auto *country{ state.locator.locate(lat, lng) };
+		if (!country)
+		{
+			co_return co_await send(not_found(req.target()));
+		}
+
+		const json located{ { "country", country->code }, { "name", country->name }, { "currency", country->currency } };
+		http::response<http::string_body> res{
+			std::piecewise_construct,
+			std::make_tuple(located.dump()),
+			std::make_tuple(http::status::ok, req.version()) };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		res.content_length(res.body().size());
+		res.keep_alive(req.keep_alive());
+		co_return co_await send(std::move(res));
 	}
 
-	// Respond to GET request
-	if (req.method() == http::verb::get)
+	// An amount in every currency, or in the comma-separated ones in "to",
+	// e.g. /?q=convert_all&amount=100&from=EUR&to=USD,GBP,JPY
+	if (req.target().starts_with("/?q=convert_all&") && req.method() == http::verb::get)
 	{
-		if (req.target() == "/?q=currency_list")
+		const auto rates{ state.cache.rates() };
+		if (!rates)
 		{
-			using namespace std::chrono_literals;
-			using namespace std::string_literals;
-			cache_storage cache{ 1h };
-			const json sentry = nullptr;
-			std::string mapkey{ "currency_list"s };
-			json currency_list = cache.query_list(currencykey, mapkey, sentry);
-
-			http::response<http::string_body> res{
-				std::piecewise_construct,
-				std::make_tuple(std::move(currency_list)),
-				std::make_tuple(http::status::ok, req.version()) };
-			res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-			res.set(http::field::content_type, "application/json");
-			res.content_length(res.body().size());
-			res.keep_alive(req.keep_alive());
-			return send(std::move(res));
+			co_return co_await send(service_unavailable("Exchange rates aren't available yet"));
 		}
-		else if (req.target() == "/")
+		const std::string_view target{ req.target().data(), req.target().size() };
+		const auto amount_text{ query_value(target, "amount") };
+		double amount{ 0.0 };
+		const auto parsed{ std::from_chars(amount_text.data(), amount_text.data() + amount_text.size(), amount) };
+		const auto from{ rates->index_of(query_value(target, "from")) };
+		if (parsed.ec != std::errc{} || parsed.ptr != amount_text.data() + amount_text.size() || !from)
 		{
-			jinja2::Template tpl;
-			tpl.LoadFromFile(path.c_str());
-			jinja2::ValuesMap params{ { { "googlekey", std::string(googlekey) } } };
-			auto render_result{ tpl.RenderAsString(params) };
-
-			if (!render_result)
-			{
-				auto error_info = render_result.error();
-				std::string error_info_str = error_to_string(error_info);
-				return send(server_error(error_info_str));
-			}
-			auto& content{ render_result.value() };
+			co_return co_await send(bad_request("Expected an amount and a known from currency"));
+		}
+		auto body{ convert_all(*rates, *from, amount, query_value(target, "to")) };
+		if (!body)
+		{
+			co_return co_await send(bad_request("Unknown currency"));
+		}
 
-			http::response<http::string_body> res{
-				std::piecewise_construct,
-				std::make_tuple(content),
+		http::response<http::string_body> res{
+			std::piecewise_construct,
+			std::make_tuple(std::move(*body)),
+			std::make_tuple(http::status::ok, req.version()) };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		res.content_length(res.body().size());
+		res.keep_alive(req.keep_alive());
+		co_return co_await send(std::move(res));
+	}
+
+	// Build the path to the requested file
+	std::string path;
+	if (req.target() != "/?q=googlekey" && req.target() != "/?q=currency_list")
+	{
+		path = path_cat(state.doc_root, req.target());
+		if (req.target().back() == '/')
+		{
+			path.append("index.html");
+		}
+	}
+
+	// Files and the rendered index page are served from memory unless the cache is off
+	if (state.assets.enabled() && req.method() == http::verb::get && !path.empty())
+	{
+		boost::beast::error_code ec;
+		std::string render_error;
+		// The rendered page is cached apart from the template it's rendered
+		// from, which is also served as is at /index.html
+		const bool rendered{ req.target() == "/" };
+		const auto key{ rendered ? "rendered:" + path : path };
+		auto asset{ state.assets.fresh(key) };
+		if (!asset && rendered)
+		{
+			// Rendering would hold up the other connections on this thread
+			try
+			{
+				asset = co_await offload(state.cpu, [&state, &key, &path, &ec]
+					{
+						return state.assets.get(key, path, "text/html",
+							[&state](const std::string &path, boost::beast::error_code &)
+							{
+								return render_index_page(state, path);
+							}, ec);
+					});
+			}
+			catch (const std::runtime_error &e)
+			{
+				render_error = e.what();
+			}
+		}
+		else if (!asset)
+		{
+			asset = state.assets.get(key, path, mime_type(path).to_string(), read_file, ec);
+		}
+		if (ec == boost::system::errc::no_such_file_or_directory)
+		{
+			co_return co_await send(not_found(req.target()));
+		}
+		if (!render_error.empty())
+		{
+			co_return co_await send(server_error(render_error));
+		}
+		if (ec)
+		{
+			co_return co_await send(server_error(ec.message()));
+		}
+		if (asset)
+		{
+			http::response<asset_body> res{
+				std::piecewise_construct,
+				std::make_tuple(asset),
+				std::make_tuple(http::status::ok, req.version()) };
+			res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+			res.set(http::field::content_type, asset->mime);
+			if (req.target() == "/")
+			{
+				res.set(http::field::access_control_allow_origin, "https://www.osmanzakir.dynu.net");
+			}
+			res.content_length(asset->content.size());
+			res.keep_alive(req.keep_alive());
+			co_return co_await send(std::move(res));
+		}
+
+		// Too large to cache, so it's sent from disk below
+	}
+
+	// Attempt to open the file
+	boost::beast::error_code ec;
+	http::file_body::value_type body;
+	if (req.target() != "/" && req.target() != "/?q=currency_list" && req.target() != "/?q=googlekey")
+	{
+		body.open(path.c_str(), boost::beast::file_mode::scan, ec);
+	}
+
+	// Handle the case where the file doesn't exist
+	if (ec == boost::system::errc::no_such_file_or_directory)
+	{
+		co_return co_await send(not_found(req.target()));
+	}
+
+	// Handle an unknown error
+	if (ec)
+	{
+		co_return co_await send(server_error(ec.message()));
+	}
+
+	// Respond to GET request
+	if (req.method() == http::verb::get)
+	{
+		if (req.target() == "/?q=currency_list")
+		{
+			const auto currency_list{ state.cache.currency_list() };
+			if (!currency_list)
+			{
+				co_return co_await send(service_unavailable("The list of currencies isn't available yet"));
+			}
+
+			http::response<http::string_body> res{
+				std::piecewise_construct,
+				std::make_tuple(*currency_list),
+				std::make_tuple(http::status::ok, req.version()) };
+			res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+			res.set(http::field::content_type, "application/json");
+			res.content_length(res.body().size());
+			res.keep_alive(req.keep_alive());
+			co_return co_await send(std::move(res));
+		}
+		else if (req.target() == "/")
+		{
+			// Rendering runs on the CPU pool, so it doesn't hold up the other
+			// connections on this thread
+			std::string content;
+			std::string render_error;
+			try
+			{
+				content = co_await offload(state.cpu, [&state, &path] { return render_index_page(state, path); });
+			}
+			catch (const std::runtime_error &e)
+			{
+				render_error = e.what();
+			}
+			if (!render_error.empty())
+			{
+				co_return co_await send(server_error(render_error));
+			}
+
+			http::response<http::string_body> res{
+				std::piecewise_construct,
+				std::make_tuple(content),
 				std::make_tuple(http::status::ok, req.version()) };
 			res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
 			res.set(http::field::content_type, "text/html");
 			//res.set(http::field::content_length, content.size());
 			res.set(http::field::access_control_allow_origin, "https://www.osmanzakir.dynu.net");
 			res.keep_alive(req.keep_alive());
-			return send(std::move(res));
+			co_return co_await send(std::move(res));
 		}
 		else
 		{
@@ -540,7 +1306,7 @@ void handle_request(boost::beast::string_view doc_root, http::request<Body, http
 			res.set(http::field::content_type, mime_type(path));
 			res.content_length(body.size());
 			res.keep_alive(req.keep_alive());
-			return send(std::move(res));
+			co_return co_await send(std::move(res));
 		}
 	}
 
@@ -551,19 +1317,30 @@ void handle_request(boost::beast::string_view doc_root, http::request<Body, http
 		if (content_type.find("multipart/form-data") == std::string::npos &&
 			content_type.find("application/x-www-form-urlencoded") == std::string::npos)
 		{
-			return send(bad_request("Bad request"));
+			co_return co_await send(bad_request("Bad request"));
 		}
 
 		using namespace std::string_literals;
-		std::map<std::string, std::string> parsed_value{ parse(req.body()) };
+		std::map<std::string, std::string> parsed_value;
+		{
+			trace::span span{ tctx, trace::phase::parse };
+			const alloc_stats::scope parsing{ accounted, alloc_stats::phase::parse };
+			parsed_value = parse(req.body());
+		}
 		auto money_amount{ std::stod(parsed_value["currency_amount"]) };
 		auto to_currency{ parsed_value["to_currency"] };
 		auto to_abbr{ to_currency.substr(0, to_currency.find_first_of(' ')) };
-		std::string_view query_data{ to_abbr };
-		using namespace std::chrono_literals;
-		cache_storage cache{ 1h };
-		const json sentry = nullptr;
-		double conversion_rate{ cache.query_rate(query_data, currencykey, sentry) };
+		const auto rates{ state.cache.rates() };
+		if (!rates)
+		{
+			co_return co_await send(service_unavailable("Exchange rates aren't available yet"));
+		}
+		const auto rate{ rates->rate(to_abbr) };
+		if (!rate)
+		{
+			co_return co_await send(bad_request("Unknown currency"));
+		}
+		double conversion_rate{ *rate };
 		double conversion_result{ calc_result(money_amount, conversion_rate) };
 
 		http::response<http::string_body> res{
@@ -574,7 +1351,7 @@ void handle_request(boost::beast::string_view doc_root, http::request<Body, http
 		res.set(http::field::content_type, "text/plain");
 		res.content_length(res.body().size());
 		res.keep_alive(req.keep_alive());
-		return send(std::move(res));
+		co_return co_await send(std::move(res));
 	}
 }
 
@@ -588,15 +1365,156 @@ std::string error_to_string(const jinja2::ErrorInfo& error)
 	return error_info_stream.str();
 }
 
+// Renders the index page template at path; throws std::runtime_error with
+// Jinja's message if it can't be rendered
+std::string render_index_page(const shared_state &state, const std::string &path)
+{
+	const alloc_stats::scope rendering{ alloc_stats::route::static_file, alloc_stats::phase::render };
+	jinja2::Template tpl;
+	tpl.LoadFromFile(path.c_str());
+	jinja2::ValuesMap params{ { { "googlekey", state.googlekey } } };
+	auto render_result{ tpl.RenderAsString(params) };
+	if (!render_result)
+	{
+		throw std::runtime_error{ error_to_string(render_result.error()) };
+	}
+	return std::move(render_result.value());
+}
+
+// Reads the first rates and currency list recorded in a capture file
+std::pair<std::shared_ptr<const rate_snapshot>, std::shared_ptr<const std::string>> load_captured_rates(
+	const std::string &path)
+{
+	capture::reader reader{ path };
+	std::shared_ptr<const rate_snapshot> rates;
+	std::shared_ptr<const std::string> list;
+	while (!rates || !list)
+	{
+		auto next{ reader.next() };
+		if (!next)
+		{
+			throw std::runtime_error{ path + " has no recorded rates and currency list" };
+		}
+		if (auto *snapshot{ std::get_if<rate_snapshot>(&*next) }; snapshot && !rates)
+		{
+			snapshot->precompute();
+			rates = std::make_shared<const rate_snapshot>(std::move(*snapshot));
+		}
+		else if (auto *currencies{ std::get_if<std::string>(&*next) }; currencies && !list)
+		{
+			list = std::make_shared<const std::string>(std::move(*currencies));
+		}
+	}
+	return { std::move(rates), std::move(list) };
+}
+
+// Adds a request to the capture file, if there is one
+template<class Fields>
+void capture_request(shared_state &state, const trace::context &tctx, const http::request_header<Fields> &header,
+	std::string_view body, bool body_omitted)
+{
+	if (state.recorder)
+	{
+		state.recorder->request(tctx.connection, tctx.request, header.version() == 20, header, body, body_omitted,
+			state.cache.rates(), state.cache.currency_list());
+	}
+}
+
+// The route a request's allocations are counted against
+alloc_stats::route accounting_route(http::verb method, boost::beast::string_view target)
+{
+	if (target == "/?q=convert_csv")
+	{
+		return alloc_stats::route::batch;
+	}
+	if (method == http::verb::post)
+	{
+		return alloc_stats::route::convert;
+	}
+	if (target.starts_with("/?q=convert_all&"))
+	{
+		return alloc_stats::route::convert_all;
+	}
+	if (target.starts_with("/?q=locate&"))
+	{
+		return alloc_stats::route::locate;
+	}
+	if (target == "/?q=currency_list" || target == "/?q=googlekey")
+	{
+		return alloc_stats::route::list;
+	}
+	if (target == "/?q=trace" || target == "/?q=alloc_stats" || target == "/?q=cpu_stats")
+	{
+		return alloc_stats::route::diagnostics;
+	}
+	return alloc_stats::route::static_file;
+}
+
+// The allocation counters of every route as JSON
+std::string alloc_stats_json()
+{
+	json routes = json::object();
+	for (std::size_t i{ 0 }; i != alloc_stats::route_count; ++i)
+	{
+		const auto totals{ alloc_stats::snapshot(static_cast<alloc_stats::route>(i)) };
+		json phases = json::object();
+		std::uint64_t allocations{ 0 }, bytes{ 0 };
+		for (std::size_t p{ 0 }; p != alloc_stats::phase_count; ++p)
+		{
+			allocations += totals.phases[p].allocations;
+			bytes += totals.phases[p].bytes;
+			if (totals.phases[p].allocations != 0)
+			{
+				phases[std::string{ alloc_stats::phase_names[p] }] = {
+					{ "allocations", totals.phases[p].allocations }, { "bytes", totals.phases[p].bytes } };
+			}
+		}
+		routes[std::string{ alloc_stats::route_names[i] }] = { { "allocations", allocations }, { "bytes", bytes },
+			{ "live", totals.live }, { "peak", totals.peak }, { "phases", std::move(phases) } };
+	}
+	// The routes are all zeros unless the server was built to count
+	const json stats = { { "allocator", alloc_stats::allocator_name }, { "counting", alloc_stats::enabled },
+		{ "routes", std::move(routes) } };
+	return stats.dump();
+}
+
+// Takes a token for the client from the route class's bucket
+std::uint32_t check_rate_limit(shared_state &state, const boost::asio::ip::address &remote, route_class what)
+{
+	const auto retry_after{ state.limiter.acquire(remote, what) };
+	if (retry_after != 0)
+	{
+		logging::log(logging::event::rate_limited, remote.to_string(), route_class_names[static_cast<std::size_t>(what)]);
+	}
+	return retry_after;
+}
+
 // Report a failure
 void fail(boost::system::error_code ec, const char *what)
 {
-	std::cerr << what << ": " << ec.message() << "\n";
+	logging::log(logging::event::io_failure, what, ec);
+}
+
+// Report a failure from a detached coroutine
+void report_exception(std::exception_ptr e)
+{
+	if (!e)
+	{
+		return;
+	}
+	try
+	{
+		std::rethrow_exception(e);
+	}
+	catch (const std::exception &ex)
+	{
+		logging::log(logging::event::session_failure, ex.what());
+	}
 }
 
 template<class Stream>
 template<bool isRequest, class Body, class Fields>
-void send_lambda<Stream>::operator()(http::message<isRequest, Body, Fields> &&msg) const
+awaitable<void> send_lambda<Stream>::operator()(http::message<isRequest, Body, Fields> msg) const
 {
 	// Determine if we should close the connection after
 	close_ = msg.need_eof();
@@ -605,56 +1523,125 @@ void send_lambda<Stream>::operator()(http::message<isRequest, Body, Fields> &&ms
 	// a non-const file_body, and the message oriented version of
 	// http::write only works with const messages.
 	http::serializer<isRequest, Body, Fields> sr{ msg };
-	http::write(stream_, sr, ec_);
+	trace::span span{ tctx_, trace::phase::write };
+	const alloc_stats::suspension suspended;
+	boost::beast::get_lowest_layer(stream_).expires_after(session_timeout);
+	co_await http::async_write(stream_, sr, boost::asio::redirect_error(use_awaitable, ec_));
 }
 
 // Handles an HTTP server connection
-void do_session(tcp::socket &socket, ssl::context &ctx, const std::string &doc_root, std::string_view googlekey,
-	std::string_view currencykey)
+awaitable<void> do_session(ssl_stream stream, shared_state &state, trace::context tctx)
 {
 	bool close{};
 	boost::system::error_code ec;
-
-	// Construct the stream around the socket
-	ssl::stream<tcp::socket&> stream{ socket, ctx };
+	const auto remote{ boost::beast::get_lowest_layer(stream).socket().remote_endpoint(ec).address() };
 
 	// Perform the SSL handshake
-	stream.handshake(ssl::stream_base::server, ec);
+	{
+		trace::span span{ tctx, trace::phase::tls_handshake };
+		boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+		co_await stream.async_handshake(ssl::stream_base::server, boost::asio::redirect_error(use_awaitable, ec));
+	}
 	if (ec)
 	{
-		std::cerr << "Lines 625 and 626:\n";
-		fail(ec, "handshake");
+		co_return fail(ec, "handshake");
+	}
+
+#if defined(CURRENCY_CONVERTER_HTTP2)
+	// A client that negotiated HTTP/2 sends all its requests over this connection as streams
+	const bool multiplexed{ http2::negotiated(stream.native_handle()) };
+	if (multiplexed)
+	{
+		co_await do_http2_session(stream, state, remote, tctx);
 	}
+#else
+	const bool multiplexed{ false };
+#endif
 
 	// This buffer is required to persist across reads 
 	boost::beast::flat_buffer buffer;
 
 	// This lambda is used to send messages 
-	send_lambda<ssl::stream<tcp::socket&>> lambda{ stream, close, ec };
+	send_lambda<ssl_stream> lambda{ stream, close, ec, tctx };
 
-	for (;;)
+	// HTTP/1.1 requests are read and answered one at a time
+	while (!multiplexed)
 	{
-		// Read a request 
-		http::request<http::string_body> req;
-		http::read(stream, buffer, req, ec);
-		if (ec == http::error::end_of_stream)
+		// Read the request header first, so that a CSV upload can be
+		// streamed instead of read into memory
+		http::request_parser<http::empty_body> header;
+		header.body_limit((std::numeric_limits<std::uint64_t>::max)());
+
+		// Between requests the connection is idle, and a draining server
+		// wakes it by cancelling the read. A new connection's first request
+		// is on its way, so it's read regardless.
+		const bool idle{ tctx.request != 0 };
+		if (idle && !state.idle.enter(tctx.connection, stream.get_executor(),
+			[&stream] { boost::beast::get_lowest_layer(stream).cancel(); }))
+		{
+			break;
+		}
+		++tctx.request;
+		{
+			trace::span span{ tctx, trace::phase::read };
+			boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+			co_await http::async_read_header(stream, buffer, header, boost::asio::redirect_error(use_awaitable, ec));
+		}
+		if (idle)
+		{
+			state.idle.leave(tctx.connection);
+		}
+		if (ec == http::error::end_of_stream || (ec == boost::asio::error::operation_aborted && state.idle.draining()))
 		{
 			break;
 		}
 		if (ec)
 		{
-			std::cerr << "Lines 646 and 647:\n";
-			return fail(ec, "read");
+			co_return fail(ec, "read");
+		}
+
+		if (header.get().method() == http::verb::post && header.get().target() == "/?q=convert_csv")
+		{
+			capture_request(state, tctx, header.get(), {}, true);
+			trace::span span{ tctx, trace::phase::handle };
+			co_await convert_csv(stream, buffer, std::move(header), state, remote, close, ec, tctx);
 		}
+		else
+		{
+			// Read the rest of the request. Beast only checks a Content-Length
+			// against the limit while parsing the header, so check it again here
+			if (header.content_length() && *header.content_length() > request_body_limit)
+			{
+				co_return fail(http::error::body_limit, "read");
+			}
+			http::request_parser<http::string_body> parser{ std::move(header) };
+			parser.body_limit(request_body_limit);
+			{
+				trace::span span{ tctx, trace::phase::read };
+				boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+				co_await http::async_read(stream, buffer, parser, boost::asio::redirect_error(use_awaitable, ec));
+			}
+			if (ec)
+			{
+				co_return fail(ec, "read");
+			}
+			capture_request(state, tctx, parser.get(), parser.get().body(), false);
 
-		// Send the response 
-		handle_request(doc_root, std::move(req), lambda, googlekey, currencykey);
+			// A draining server tells the client to reconnect, which reaches the new one
+			if (state.idle.draining())
+			{
+				parser.get().keep_alive(false);
+			}
+
+			// Send the response 
+			trace::span span{ tctx, trace::phase::handle };
+			co_await handle_request(state, parser.release(), lambda, remote, tctx);
+		}
 		if (ec)
 		{
-			std::cerr << "Lines 654 and 655:\n";
-			return fail(ec, "write");
+			co_return fail(ec, "write");
 		}
-		if (close)
+		if (close || state.idle.draining())
 		{
 			// This means we should close the connection, usually because 
 			// the response indicated the "Connection: close" semantic. 
@@ -663,210 +1650,677 @@ void do_session(tcp::socket &socket, ssl::context &ctx, const std::string &doc_r
 	}
 
 	// Perform the SSL shutdown 
-	stream.shutdown(ec);
-	if (ec)
+	boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+	co_await stream.async_shutdown(boost::asio::redirect_error(use_awaitable, ec));
+	if (ec && ec != ssl::error::stream_truncated)
 	{
-		std::cerr << "Lines 669 and 670:\n";
-		return fail(ec, "shutdown");
+		co_return fail(ec, "shutdown");
 	}
 
-	// At this point the connection is closed gracefully
+	// At this point the connection is closed gracefully, or the client
+	// hung up without waiting for the TLS close, which is common
 }
 
-
-// This function queries the currency API after making sure
-// that the stored result(s) is/are old enough
-// It also makes a new query to the API if needed
-const json &cache_storage::query_rate(std::string_view query_data, std::string_view currencykey, 
-	const json &sentry)
+// Streams the conversion of an uploaded CSV ledger: rows are converted as the
+// upload arrives, against a single rate snapshot, and the results are sent
+// back with chunked transfer encoding
+awaitable<void> convert_csv(ssl_stream &stream, boost::beast::flat_buffer &buffer,
+	http::request_parser<http::empty_body> &&header, shared_state &state, const boost::asio::ip::address &remote,
+	bool &close, boost::system::error_code &ec, const trace::context &tctx)
 {
-	using namespace std::string_literals;
-	auto found{ m_cache_conv.find(std::string(query_data)) };
-	boost::beast::error_code ec;
-	try
+	const auto version{ header.get().version() };
+	send_lambda<ssl_stream> send{ stream, close, ec, tctx };
+
+	if (const auto retry_after{ check_rate_limit(state, remote, route_class::batch) })
 	{
-		if (found == m_cache_conv.end() || (std::chrono::steady_clock::now() - found->second.first) > m_duration)
-		{
-			auto host{ "openexchangerates.org"s }, api_endpoint{ "/api/latest.json"s };
-			std::string currency_to{ query_data };
-			auto target{ api_endpoint + "?app_id="s + std::string(currencykey) + "&symbols="s + currency_to };
-			auto port{ "443"s };
-			int version{ 11 };
+		// The upload is never read, so the connection can't be reused
+		http::response<http::string_body> res{ http::status::too_many_requests, version };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/html");
+		res.set(http::field::retry_after, std::to_string(retry_after));
+		res.keep_alive(false);
+		res.body() = "Too many requests";
+		res.prepare_payload();
+		co_return co_await send(std::move(res));
+	}
 
-			// The io_context is required for all IO
-			boost::asio::io_context ioc;
+	// Every row is converted with the rates that are current now
+	const auto rates{ state.cache.rates() };
+	if (!rates)
+	{
+		// The upload is never read, so the connection can't be reused
+		http::response<http::string_body> res{ http::status::service_unavailable, version };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "text/html");
+		res.set(http::field::retry_after, "5");
+		res.keep_alive(false);
+		res.body() = "Exchange rates aren't available yet";
+		res.prepare_payload();
+		co_return co_await send(std::move(res));
+	}
 
-			// The SSL context is required, and holds certificates
-			ssl::context ctx{ ssl::context::tlsv12_client };
+	// Clients that wait for permission to send the upload get it
+	if (boost::beast::iequals(header.get()[http::field::expect], "100-continue"))
+	{
+		http::response<http::empty_body> res{ http::status::continue_, version };
+		boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+		co_await http::async_write(stream, res, boost::asio::redirect_error(use_awaitable, ec));
+		if (ec)
+		{
+			co_return;
+		}
+	}
 
-			// These objects perform our IO
-			tcp::resolver resolver{ ioc };
-			ssl::stream<tcp::socket> stream{ ioc, ctx };
+	// The body is read into a fixed buffer, so there's no limit on its size
+	http::request_parser<http::buffer_body> parser{ std::move(header) };
 
-			// Set SNI Hostname (many hosts need this to handshake successfully)
-			if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str()))
-			{
-				boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
-				throw boost::system::system_error{ ec };
-			}
+	http::response<http::empty_body> res{ http::status::ok, version };
+	res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+	res.set(http::field::content_type, "text/csv");
+	res.set("X-Rates-Timestamp", std::to_string(rates->timestamp));
+	res.keep_alive(parser.get().keep_alive());
+	res.chunked(true);
+	close = res.need_eof();
 
-			// Look up the domain name
-			const auto results = resolver.resolve(host, port);
+	http::response_serializer<http::empty_body> sr{ res };
+	boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+	co_await http::async_write_header(stream, sr, boost::asio::redirect_error(use_awaitable, ec));
+	if (ec)
+	{
+		co_return;
+	}
 
-			// This holds the root certificate used for verification
-			load_root_certificates(ctx);
+	csv_converter converter{ rates };
+	std::array<char, csv_chunk_size> in;
+	std::string out{ csv_converter::header };
+	out.reserve(2 * csv_chunk_size);
 
-			// Verify the remote server's certificate
-			ctx.set_verify_mode(ssl::verify_peer);
+	// Sends what has been converted so far as one chunk
+	const auto flush = [&stream, &out, &ec]() -> awaitable<void>
+	{
+		boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+		co_await boost::asio::async_write(stream, http::make_chunk(boost::asio::buffer(out)),
+			boost::asio::redirect_error(use_awaitable, ec));
+		out.clear();
+	};
 
-			// Make the connection on the IP address we get from a lookup
-			boost::asio::connect(stream.next_layer(), results.begin(), results.end());
+	while (!parser.is_done())
+	{
+		parser.get().body().data = in.data();
+		parser.get().body().size = in.size();
+		boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+		co_await http::async_read(stream, buffer, parser, boost::asio::redirect_error(use_awaitable, ec));
+		if (ec == http::error::need_buffer)
+		{
+			// The buffer is full, which is expected
+			ec = {};
+		}
+		if (ec)
+		{
+			co_return;
+		}
 
-			// Perform the SSL handshake
-			stream.handshake(ssl::stream_base::client, ec);
+		{
+			// Converting a chunk is CPU-bound, so it runs on the CPU pool
+			const alloc_stats::scope converting{ alloc_stats::route::batch, alloc_stats::phase::handle };
+			const std::string_view chunk{ in.data(), in.size() - parser.get().body().size };
+			co_await offload(state.cpu, [&converter, chunk, &out] { converter.feed(chunk, out); });
+		}
+		if (out.size() >= csv_chunk_size)
+		{
+			co_await flush();
 			if (ec)
 			{
-				std::cerr << "Lines 729 and 730:\n";
-				fail(ec, "handshake");
+				co_return;
 			}
+		}
+	}
 
-			// Set up an HTTP GET request message
-			http::request<http::string_body> req{ http::verb::get, target, version };
-			req.set(http::field::host, host);
-			req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+	{
+		const alloc_stats::scope converting{ alloc_stats::route::batch, alloc_stats::phase::handle };
+		converter.finish(out);
+	}
+	if (!out.empty())
+	{
+		co_await flush();
+		if (ec)
+		{
+			co_return;
+		}
+	}
+	boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+	co_await boost::asio::async_write(stream, http::make_chunk_last(), boost::asio::redirect_error(use_awaitable, ec));
+}
 
-			// Send the HTTP request to the remote host
-			http::write(stream, req);
+#if defined(CURRENCY_CONVERTER_HTTP2)
+http2_connection::http2_connection(ssl_stream &stream, shared_state &state, const boost::asio::ip::address &remote,
+	const trace::context &tctx)
+	: stream{ stream }, state{ state }, remote{ remote }, tctx{ tctx },
+	session{ [this](std::int32_t stream_id, http2::request &&req) { on_request(stream_id, std::move(req)); },
+		[this](const http2::request &req) { return route(req); }, request_body_limit, 4 * csv_chunk_size },
+	write_done{ stream.get_executor() }
+{
+}
 
-			// This buffer is used for reading and must be persisted
-			boost::beast::flat_buffer buffer;
+// Starts a coroutine that answers a complete request
+void http2_connection::on_request(std::int32_t stream_id, http2::request &&req)
+{
+	// co_spawn posts, so the coroutine never runs inside nghttp2's callbacks
+	boost::asio::co_spawn(stream.get_executor(),
+		[conn = shared_from_this(), stream_id, req = std::move(req)]() mutable -> awaitable<void>
+		{
+			auto tctx{ conn->tctx };
+			tctx.request = static_cast<std::uint32_t>(stream_id);
+			http2_send send{ conn, stream_id, tctx };
+			capture_request(conn->state, tctx, req, req.body(), false);
+			trace::span span{ tctx, trace::phase::handle };
+			co_await handle_request(conn->state, std::move(req), send, conn->remote, tctx);
+		}, report_exception);
+}
 
-			// Declare a container to hold the response
-			http::response<http::string_body> res;
+// CSV uploads are converted as they stream in; other requests are read whole
+std::optional<http2::streamed_response> http2_connection::route(const http2::request &req)
+{
+	if (req.method() != http::verb::post || req.target() != "/?q=convert_csv")
+	{
+		return std::nullopt;
+	}
+	capture_request(state, tctx, req, {}, true);
 
-			// Receive the HTTP response
-			http::read(stream, buffer, res);
-			found = m_cache_conv.insert_or_assign(found, query_data, std::make_pair(std::chrono::steady_clock::now(),
-				json::parse(res.body())["rates"][currency_to].get<double>()));
+	http2::streamed_response res;
+	res.header.set(http::field::server, BOOST_BEAST_VERSION_STRING);
 
-			// Gracefully close the stream
-			boost::system::error_code ec;
-			stream.shutdown(ec);
-			if (ec == boost::asio::error::eof)
+	if (const auto retry_after{ check_rate_limit(state, remote, route_class::batch) })
+	{
+		res.header.result(http::status::too_many_requests);
+		res.header.set(http::field::content_type, "text/html");
+		res.header.set(http::field::retry_after, std::to_string(retry_after));
+		res.filter = [](std::string_view, bool last, std::string &out)
+		{
+			if (last)
 			{
-				// Rationale:
-				// http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
-				ec.assign(0, ec.category());
+				out = "Too many requests";
 			}
-			if (ec)
+		};
+		return res;
+	}
+
+	// Every row is converted with the rates that are current now
+	const auto rates{ state.cache.rates() };
+	if (!rates)
+	{
+		res.header.result(http::status::service_unavailable);
+		res.header.set(http::field::content_type, "text/html");
+		res.header.set(http::field::retry_after, "5");
+		res.filter = [](std::string_view, bool last, std::string &out)
+		{
+			if (last)
 			{
-				throw boost::system::system_error{ ec };
+				out = "Exchange rates aren't available yet";
 			}
-
-			// If we get here then the connection is closed gracefully
-		}
-		return found->second.second;
+		};
+		return res;
 	}
-	catch (const std::exception &e)
+
+	res.header.result(http::status::ok);
+	res.header.set(http::field::content_type, "text/csv");
+	res.header.set("X-Rates-Timestamp", std::to_string(rates->timestamp));
+	res.filter = [converter = std::make_shared<csv_converter>(rates), started = false](std::string_view chunk, bool last,
+		std::string &out) mutable
 	{
-		std::cerr << "Line 772: Error: " << e.what() << '\n';
-	}
-	return sentry;
+		const alloc_stats::scope converting{ alloc_stats::route::batch, alloc_stats::phase::handle };
+		if (!started)
+		{
+			out.append(csv_converter::header);
+			started = true;
+		}
+		if (last)
+		{
+			converter->finish(out);
+		}
+		else
+		{
+			converter->feed(chunk, out);
+		}
+	};
+	return res;
 }
 
-const json &cache_storage::query_list(std::string_view mapkey, std::string_view currencykey, const json &sentry) 
+// Writes queued frames until there are none left
+awaitable<void> http2_connection::flush()
 {
-	using namespace std::string_literals;
-	auto found{ m_cache_list.find(std::string(mapkey)) };
-	boost::beast::error_code ec;
-	try
+	if (writing || !open)
 	{
-		if (found == m_cache_list.end() || (std::chrono::steady_clock::now() - found->second.first) > m_duration)
+		co_return;
+	}
+	writing = true;
+	std::string out;
+	while (open && session.pending_output(out))
+	{
+		trace::span span{ tctx, trace::phase::write };
+		boost::system::error_code ec;
+		boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+		co_await boost::asio::async_write(stream, boost::asio::buffer(out), boost::asio::redirect_error(use_awaitable, ec));
+		out.clear();
+		if (ec)
 		{
-			auto host{ "openexchangerates.org"s }, api_endpoint{ "/api/currencies.json"s };
-			auto target{ api_endpoint + "?app_id="s + std::string{ currencykey } };
-			std::string port{ "443" };
-			int version{ 11 };
+			fail(ec, "write");
+			open = false;
+		}
+	}
+	writing = false;
+	write_done.cancel();
+}
 
-			// The io_context is required for all IO
-			boost::asio::io_context ioc;
+template<bool isRequest, class Body, class Fields>
+awaitable<void> http2_send::operator()(http::message<isRequest, Body, Fields> msg) const
+{
+	conn_->session.respond(stream_id_, std::move(msg));
+	const alloc_stats::suspension suspended;
+	co_await conn_->flush();
+}
 
-			// The SSL context is required, and holds certificates
-			ssl::context ctx{ ssl::context::tlsv12_client };
+// Handles a connection that negotiated HTTP/2 until either side ends it
+awaitable<void> do_http2_session(ssl_stream &stream, shared_state &state, const boost::asio::ip::address &remote,
+	const trace::context &tctx)
+{
+	const auto conn{ std::make_shared<http2_connection>(stream, state, remote, tctx) };
+	conn->session.start();
+
+	// A draining server sends a GOAWAY at once, even to an idle connection:
+	// the streams already started finish, and the client goes elsewhere for
+	// the rest. The flush runs alongside a pending read, which it may; if
+	// no streams are left, the read is then cancelled to end the session.
+	const auto executor{ stream.get_executor() };
+	const auto go_away = [conn, executor]
+	{
+		conn->session.shut_down();
+		boost::asio::co_spawn(executor, [conn]() -> awaitable<void>
+			{
+				co_await conn->flush();
+				if (conn->open && !conn->writing && !conn->session.want_read())
+				{
+					boost::beast::get_lowest_layer(conn->stream).cancel();
+				}
+			}, report_exception);
+	};
+	if (!state.idle.enter(tctx.connection, executor, go_away))
+	{
+		conn->session.shut_down();
+	}
 
-			// These objects perform our IO
-			tcp::resolver resolver{ ioc };
-			ssl::stream<tcp::socket> stream{ ioc, ctx };
+	std::array<char, 16384> in;
+	for (;;)
+	{
+		co_await conn->flush();
+		if (!conn->open || !conn->session.want_read())
+		{
+			break;
+		}
 
-			// Set SNI Hostname (many hosts need this to handshake successfully)
-			if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str()))
+		boost::system::error_code ec;
+		std::size_t n{ 0 };
+		{
+			trace::span span{ tctx, trace::phase::read };
+			boost::beast::get_lowest_layer(stream).expires_after(session_timeout);
+			n = co_await stream.async_read_some(boost::asio::buffer(in), boost::asio::redirect_error(use_awaitable, ec));
+		}
+		if (ec)
+		{
+			if (ec != boost::asio::error::eof && ec != ssl::error::stream_truncated &&
+				(ec != boost::asio::error::operation_aborted || !state.idle.draining()))
 			{
-				boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
-				throw boost::system::system_error{ ec };
+				fail(ec, "read");
 			}
+			break;
+		}
+		if (!conn->session.receive(in.data(), n))
+		{
+			// nghttp2 has queued a GOAWAY; send it and hang up
+			co_await conn->flush();
+			break;
+		}
+	}
 
-			// Look up the domain name
-			const auto results{ resolver.resolve(host, port) };
+	// Streams still being answered can't write once the session returns,
+	// so wait for a write in progress to finish
+	state.idle.leave(tctx.connection);
+	conn->open = false;
+	while (conn->writing)
+	{
+		boost::system::error_code ec;
+		conn->write_done.expires_at((std::chrono::steady_clock::time_point::max)());
+		co_await conn->write_done.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+	}
+}
+#endif
+
+// Accepts incoming connections and spawns a session coroutine for each one
+awaitable<void> do_listen(tcp::acceptor &acceptor, ssl::context &ctx, shared_state &state)
+{
+	for (;;)
+	{
+		// Each connection gets its own strand, so its session and the
+		// stream's timers never run concurrently
+		tcp::socket socket{ boost::asio::make_strand(acceptor.get_executor()) };
+		boost::system::error_code ec;
+		const auto accept_start{ trace::ticks() };
+		co_await acceptor.async_accept(socket, boost::asio::redirect_error(use_awaitable, ec));
+		if (ec == boost::asio::error::operation_aborted || !acceptor.is_open())
+		{
+			// Closed, because a newer server has taken over
+			co_return;
+		}
+		if (ec)
+		{
+			fail(ec, "accept");
+			continue;
+		}
+		auto tctx{ trace::tracer::instance().begin_connection() };
+		trace::tracer::instance().record(tctx, trace::phase::accept, accept_start, trace::ticks());
+
+		// Launch the session, transferring ownership of the socket
+		const auto executor{ socket.get_executor() };
+		++state.sessions;
+		boost::asio::co_spawn(executor, do_session(ssl_stream{ std::move(socket), ctx }, state, tctx),
+			[&state](std::exception_ptr e)
+			{
+				--state.sessions;
+				report_exception(e);
+			});
+	}
+}
 
-			// This holds the root certificate used for verification
-			load_root_certificates(ctx);
+#if !defined(_WIN32)
+// Hands the listener and the cached rates to a newer server that connects to
+// the handoff socket, then stops accepting, drains the sessions and stops ioc
+awaitable<void> serve_handoff(unix_socket::acceptor &successors, tcp::acceptor &acceptor, shared_state &state,
+	boost::asio::io_context &ioc, std::chrono::seconds drain_deadline)
+{
+	for (;;)
+	{
+		boost::system::error_code ec;
+		auto accepted = co_await successors.async_accept(boost::asio::redirect_error(use_awaitable, ec));
+		if (ec)
+		{
+			fail(ec, "handoff accept");
+			continue;
+		}
+		boost::beast::basic_stream<unix_socket> successor{ std::move(accepted) };
+		try
+		{
+			handoff::send(successor.socket().native_handle(), acceptor.native_handle(), state.cache.rates(), state.cache.currency_list());
+		}
+		catch (const std::exception &e)
+		{
+			logging::log(logging::event::io_failure, "handoff", e.what());
+			continue;
+		}
 
-			// Verify the remote server's certificate
-			ctx.set_verify_mode(ssl::verify_peer);
+		// The new server answers once it is accepting; if it fails or hangs
+		// first, this one carries on as if nothing happened
+		char done{};
+		successor.expires_after(handoff::timeout);
+		co_await boost::asio::async_read(successor, boost::asio::buffer(&done, 1), boost::asio::redirect_error(use_awaitable, ec));
+		if (!ec)
+		{
+			break;
+		}
+		fail(ec, "handoff");
+	}
 
-			// Make the connection on the IP address we get from a lookup
-			boost::asio::connect(stream.next_layer(), results.begin(), results.end());
+	// The socket file now belongs to the new server, so it's closed but not removed
+	boost::system::error_code ec;
+	successors.close(ec);
+	acceptor.close(ec);
+	state.idle.drain();
+	logging::log(logging::event::handed_off, state.sessions.load(), drain_deadline.count());
+
+	const auto deadline{ std::chrono::steady_clock::now() + drain_deadline };
+	boost::asio::steady_timer timer{ ioc };
+	while (state.sessions.load() != 0 && std::chrono::steady_clock::now() < deadline)
+	{
+		timer.expires_after(std::chrono::milliseconds{ 100 });
+		co_await timer.async_wait(use_awaitable);
+	}
+	logging::log(logging::event::drained, state.sessions.load());
+	ioc.stop();
+}
+#endif
 
-			// Perform the SSL handshake
-			stream.handshake(ssl::stream_base::client, ec);
+// Writes the recently traced spans to trace.json whenever SIGUSR1 arrives
+void watch_trace_signal(boost::asio::signal_set &signals)
+{
+	signals.async_wait([&signals](const boost::system::error_code &ec, int)
+		{
 			if (ec)
 			{
-				std::cerr << "Lines 824 and 825:\n";
-				fail(ec, "handshake");
+				return fail(ec, "signal");
 			}
+			std::ofstream ofs{ "trace.json", std::ios::binary };
+			ofs << trace::tracer::instance().dump();
+			watch_trace_signal(signals);
+		});
+}
+
+// Sends a GET request for target to the currency API and passes the response
+// body to on_data a chunk at a time, as it arrives
+// The coroutine suspends on every network operation, so no thread waits on the API
+template<class DataHandler>
+awaitable<void> cache_storage::fetch(const std::string &target, const trace::context &tctx, DataHandler on_data)
+{
+	using namespace std::string_literals;
+	const auto host{ "openexchangerates.org"s };
+	const auto port{ "443"s };
+	int version{ 11 };
+	const auto executor{ co_await boost::asio::this_coro::executor };
+
+	// These objects perform our IO
+	tcp::resolver resolver{ executor };
+	ssl_stream stream{ executor, m_ctx };
+
+	// Set SNI Hostname (many hosts need this to handshake successfully)
+	if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str()))
+	{
+		boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
+		throw boost::system::system_error{ ec };
+	}
+
+	// Look up the domain name
+	tcp::resolver::results_type results;
+	{
+		trace::span span{ tctx, trace::phase::upstream_resolve };
+		results = co_await resolver.async_resolve(host, port, use_awaitable);
+	}
+
+	// Make the connection on the IP address we get from a lookup
+	{
+		trace::span span{ tctx, trace::phase::upstream_connect };
+		boost::beast::get_lowest_layer(stream).expires_after(upstream_timeout);
+		co_await boost::beast::get_lowest_layer(stream).async_connect(results, use_awaitable);
+	}
 
-			// Set up an HTTP GET request message
-			http::request<http::string_body> req{ http::verb::get, target, version };
-			req.set(http::field::host, host);
-			req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+	// Perform the SSL handshake
+	{
+		trace::span span{ tctx, trace::phase::upstream_handshake };
+		boost::beast::get_lowest_layer(stream).expires_after(upstream_timeout);
+		co_await stream.async_handshake(ssl::stream_base::client, use_awaitable);
+	}
+
+	// Set up an HTTP GET request message
+	http::request<http::string_body> req{ http::verb::get, target, version };
+	req.set(http::field::host, host);
+	req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
 
-			// Send the HTTP request to the remote host
-			http::write(stream, req);
+	// Send the HTTP request to the remote host
+	{
+		trace::span span{ tctx, trace::phase::upstream_write };
+		boost::beast::get_lowest_layer(stream).expires_after(upstream_timeout);
+		co_await http::async_write(stream, req, use_awaitable);
+	}
 
-			// This buffer is used for reading and must be persisted
-			boost::beast::flat_buffer buffer;
+	// This buffer is used for reading and must be persisted
+	boost::beast::flat_buffer buffer;
 
-			// Declare a container to hold the response
-			http::response<http::string_body> res;
+	// The body is parsed into this fixed chunk rather than accumulated,
+	// so memory use doesn't grow with the size of the response
+	http::response_parser<http::buffer_body> parser;
+	std::array<char, upstream_chunk_size> chunk;
 
-			// Receive the HTTP response
-			http::read(stream, buffer, res);
-			found = m_cache_list.insert_or_assign(found, std::string(mapkey), 
-				std::make_pair(std::chrono::steady_clock::now(), res.body()));
+	// Receive the HTTP response
+	{
+		trace::span span{ tctx, trace::phase::upstream_read };
+		boost::beast::get_lowest_layer(stream).expires_after(upstream_timeout);
+		co_await http::async_read_header(stream, buffer, parser, use_awaitable);
+		if (parser.get().result() != http::status::ok)
+		{
+			throw std::runtime_error{ "The currency API answered with status " + std::to_string(parser.get().result_int()) };
+		}
 
-			// Gracefully close the stream
+		while (!parser.is_done())
+		{
+			parser.get().body().data = chunk.data();
+			parser.get().body().size = chunk.size();
 			boost::system::error_code ec;
-			stream.shutdown(ec);
-			if (ec == boost::asio::error::eof)
+			boost::beast::get_lowest_layer(stream).expires_after(upstream_timeout);
+			co_await http::async_read(stream, buffer, parser, boost::asio::redirect_error(use_awaitable, ec));
+			if (ec == http::error::need_buffer)
 			{
-				// Rationale:
-				// http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
-				ec.assign(0, ec.category());
+				// The chunk is full, which is expected
+				ec = {};
 			}
 			if (ec)
 			{
 				throw boost::system::system_error{ ec };
 			}
+			on_data(std::string_view{ chunk.data(), chunk.size() - parser.get().body().size });
+		}
+	}
+
+	// Gracefully close the stream
+	boost::system::error_code ec;
+	boost::beast::get_lowest_layer(stream).expires_after(upstream_timeout);
+	co_await stream.async_shutdown(boost::asio::redirect_error(use_awaitable, ec));
+	if (ec == boost::asio::error::eof)
+	{
+		// Rationale:
+		// http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
+		ec.assign(0, ec.category());
+	}
+	if (ec)
+	{
+		// The response is already complete, so a failed shutdown doesn't lose it
+		fail(ec, "shutdown");
+	}
+
+	// If we get here then the connection is closed
+}
+
+// Keeps the rates and the currency list up to date for as long as the
+// io_context runs
+awaitable<void> cache_storage::refresh(cpu_pool &cpu)
+{
+	using namespace std::string_literals;
+	const auto executor{ co_await boost::asio::this_coro::executor };
+	boost::asio::steady_timer timer{ executor };
+
+	co_await query_usage();
+
+	// Rates taken over from the previous server are current until the next publication
+	if (const auto adopted{ m_rates.load() })
+	{
+		timer.expires_after(m_schedule.after_success(adopted->timestamp, std::chrono::system_clock::now()));
+		co_await timer.async_wait(use_awaitable);
+	}
+
+	for (;;)
+	{
+		// The list of currencies hardly ever changes, so once a day is plenty
+		if (!m_list.load() || std::chrono::steady_clock::now() - m_list_fetched > std::chrono::hours{ 24 })
+		{
+			try
+			{
+				m_schedule.consumed(std::chrono::system_clock::now());
+				std::string list;
+				const auto tctx{ trace::tracer::instance().begin_background() };
+				co_await fetch("/api/currencies.json?app_id="s + m_currencykey, tctx, [&list](std::string_view data)
+					{
+						list.append(data);
+					});
+				m_list.store(std::make_shared<const std::string>(std::move(list)));
+				m_list_fetched = std::chrono::steady_clock::now();
+			}
+			catch (const std::exception &e)
+			{
+				logging::log(logging::event::upstream_failure, "currency_list", e.what());
+			}
+		}
+
+		std::chrono::seconds delay;
+		try
+		{
+			m_schedule.consumed(std::chrono::system_clock::now());
+			rate_table_parser parser;
+			const auto tctx{ trace::tracer::instance().begin_background() };
+			co_await fetch("/api/latest.json?app_id="s + m_currencykey, tctx, [&parser](std::string_view data)
+				{
+					parser.feed(data);
+				});
+			auto snapshot = co_await offload(cpu, [&parser] { return parser.finish(); });
+			delay = m_schedule.after_success(snapshot->timestamp, std::chrono::system_clock::now());
+			logging::log(logging::event::rates_refreshed, snapshot->rates.size(), snapshot->timestamp,
+				delay.count(), m_schedule.used());
+			m_rates.store(std::move(snapshot));
+		}
+		catch (const std::exception &e)
+		{
+			logging::log(logging::event::upstream_failure, "latest", e.what());
+			delay = m_schedule.after_failure(std::chrono::system_clock::now());
+		}
+
+		timer.expires_after(delay);
+		co_await timer.async_wait(use_awaitable);
+	}
+}
+
+// Asks the API how much of this month's quota is already used, and how
+// often the plan publishes rates. Without it the schedule counts from zero.
+awaitable<void> cache_storage::query_usage()
+{
+	using namespace std::string_literals;
+	try
+	{
+		std::string body;
+		const auto tctx{ trace::tracer::instance().begin_background() };
+		co_await fetch("/api/usage.json?app_id="s + m_currencykey, tctx, [&body](std::string_view data)
+			{
+				body.append(data);
+			});
+		const auto data{ json::parse(body).at("data") };
+		const auto &usage{ data.at("usage") };
+
+		// The configured quota can only lower the plan's, e.g. to leave some
+		// of it for other users of the same key
+		const auto configured{ m_schedule.quota() };
+		const auto reported{ usage.at("requests_quota").get<std::uint32_t>() };
+		const auto quota{ std::min(configured, reported) };
+		if (configured != reported)
+		{
+			logging::log(logging::event::quota_mismatch, configured, reported, quota);
+		}
+		m_schedule.seed(usage.at("requests").get<std::uint32_t>(), quota, std::chrono::system_clock::now());
 
-			// If we get here then the connection is closed gracefully
+		// Given as a string such as "3600s"
+		const auto frequency{ data.at("plan").at("update_frequency").get<std::string>() };
+		if (const auto seconds{ std::strtol(frequency.c_str(), nullptr, 10) }; seconds > 0)
+		{
+			m_schedule.set_publish_interval(std::chrono::seconds{ seconds });
 		}
-		return found->second.second;
 	}
-	catch (const std::exception& e)
+	catch (const std::exception &e)
 	{
-		std::cerr << "Line 867: Error: " << e.what() << std::endl;
+		logging::log(logging::event::upstream_failure, "usage", e.what());
 	}
-	return sentry;
 }
 
 // Performs currency conversion calculation
@@ -874,4 +2328,124 @@ double calc_result(const double money_amount, const double conversion_rate)
 {
 	double result{ money_amount * conversion_rate };
 	return result;
-}
\ No newline at end of file
+}
+
+// Converts an amount into every currency, or the listed ones, in one pass over a row of cross rates
+std::optional<std::string> convert_all(const rate_snapshot &rates, std::size_t from, double amount, std::string_view to)
+{
+	const auto &cross{ rates.cross };
+	thread_local std::vector<double> results;
+	results.resize(cross.stride());
+	cross.convert(from, amount, results.data());
+
+	// Appends a result; JSON has no infinities, which a rate of 0 would give
+	std::array<char, 32> number;
+	const auto append_number = [&number](std::string &out, double value)
+	{
+		if (!std::isfinite(value))
+		{
+			out.append("null");
+			return;
+		}
+		const auto written{ std::to_chars(number.data(), number.data() + number.size(), value) };
+		out.append(number.data(), written.ptr);
+	};
+
+	std::string out{ "{\"timestamp\":" };
+	out.reserve(64 + rates.codes_json.size() + 24 * cross.size());
+	out.append(std::to_string(rates.timestamp)).append(",\"from\":\"").append(unpack_code(rates.codes[from]));
+	out.append("\",\"amount\":");
+	append_number(out, amount);
+	out.append(",\"to\":");
+	if (to.empty())
+	{
+		// Every currency: the codes were serialized once for the snapshot
+		out.append(rates.codes_json).append(",\"results\":[");
+		for (std::size_t j{ 0 }; j != cross.size(); ++j)
+		{
+			if (j != 0)
+			{
+				out.push_back(',');
+			}
+			append_number(out, results[j]);
+		}
+	}
+	else
+	{
+		std::string values{ "[" };
+		out.push_back('[');
+		while (!to.empty())
+		{
+			const auto comma{ std::min(to.find(','), to.size()) };
+			const auto index{ rates.index_of(to.substr(0, comma)) };
+			if (!index)
+			{
+				return std::nullopt;
+			}
+			if (values.size() != 1)
+			{
+				out.push_back(',');
+				values.push_back(',');
+			}
+			out.append(1, '"').append(unpack_code(rates.codes[*index])).push_back('"');
+			append_number(values, results[*index]);
+			to.remove_prefix(std::min(comma + 1, to.size()));
+		}
+		out.append("],\"results\":").append(values);
+	}
+	out.append("]}");
+	return out;
+}
+
+#if defined(CURRENCY_CONVERTER_ALLOC_STATS) || defined(CURRENCY_CONVERTER_MIMALLOC)
+// Every allocation in the program goes through the accounting layer, or
+// straight to the allocator chosen at build time
+
+static void *allocate_or_null(std::size_t size, std::size_t align) noexcept
+{
+#if defined(CURRENCY_CONVERTER_ALLOC_STATS)
+	return alloc_stats::allocate(size == 0 ? 1 : size, align);
+#else
+	return alloc_stats::backing::allocate(size == 0 ? 1 : size, align);
+#endif
+}
+
+static void *allocate_or_throw(std::size_t size, std::size_t align)
+{
+	if (auto *p{ allocate_or_null(size, align) })
+	{
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+static void deallocate(void *p) noexcept
+{
+#if defined(CURRENCY_CONVERTER_ALLOC_STATS)
+	alloc_stats::release(p);
+#else
+	alloc_stats::backing::release(p);
+#endif
+}
+
+void *operator new(std::size_t size) { return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](std::size_t size) { return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(std::size_t size, std::align_val_t align) { return allocate_or_throw(size, static_cast<std::size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align) { return allocate_or_throw(size, static_cast<std::size_t>(align)); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate_or_null(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate_or_null(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return allocate_or_null(size, static_cast<std::size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return allocate_or_null(size, static_cast<std::size_t>(align)); }
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, std::size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::size_t) noexcept { deallocate(p); }
+void operator delete(void *p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { deallocate(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { deallocate(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(p); }
+#endif
\ No newline at end of file
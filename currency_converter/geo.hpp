@@ -0,0 +1,303 @@
+#ifndef GEO_H
+#define GEO_H
+
+#include "countries.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+	Finds the country at a latitude and longitude without asking Google.
+
+	Country boundaries are read once from a GeoJSON FeatureCollection (the
+	Natural Earth admin 0 countries file works as is). Each ring is thinned
+	with Douglas-Peucker to within simplify_tolerance degrees, which keeps
+	the point-in-polygon tests short without moving a border by more than
+	about a kilometre. Polygons are then bucketed by the one-degree cells
+	their bounding boxes cover, so a lookup only tests the few polygons
+	near the point.
+*/
+
+class country_locator
+{
+public:
+	static constexpr double simplify_tolerance = 0.01;
+
+	country_locator() = default;
+
+	// Reads boundaries from a GeoJSON file; throws std::runtime_error if it can't
+	static country_locator load(const std::string &path)
+	{
+		std::ifstream ifs{ path, std::ios::binary };
+		if (!ifs)
+		{
+			throw std::runtime_error{ "Can't open " + path };
+		}
+		const auto doc = nlohmann::json::parse(ifs, nullptr, false);
+		if (doc.is_discarded() || !doc.contains("features"))
+		{
+			throw std::runtime_error{ path + " isn't a GeoJSON FeatureCollection" };
+		}
+
+		country_locator locator;
+		for (const auto &feature : doc["features"])
+		{
+			const auto country{ feature_country(feature) };
+			if (!country || !feature.contains("geometry") || feature["geometry"].is_null())
+			{
+				continue;
+			}
+			const auto &geometry{ feature["geometry"] };
+			const auto type{ geometry.value("type", std::string{}) };
+			if (type == "Polygon")
+			{
+				locator.add_polygon(country, geometry["coordinates"]);
+			}
+			else if (type == "MultiPolygon")
+			{
+				for (const auto &polygon : geometry["coordinates"])
+				{
+					locator.add_polygon(country, polygon);
+				}
+			}
+		}
+		locator.build_grid();
+		return locator;
+	}
+
+	// False until boundaries have been loaded
+	bool empty() const
+	{
+		return m_polygons.empty();
+	}
+
+	// The country containing the point, or null for the sea and unknown places
+	const country_info *locate(double lat, double lng) const
+	{
+		if (m_polygons.empty() || !(lat >= -90.0 && lat <= 90.0 && lng >= -180.0 && lng <= 180.0))
+		{
+			return nullptr;
+		}
+		const auto p{ point{ static_cast<float>(lng), static_cast<float>(lat) } };
+		const auto cell{ cell_of(lng, lat) };
+		for (auto i{ m_cell_offsets[cell] }; i != m_cell_offsets[cell + 1]; ++i)
+		{
+			const auto &poly{ m_polygons[m_cell_items[i]] };
+			if (p.x >= poly.min.x && p.x <= poly.max.x && p.y >= poly.min.y && p.y <= poly.max.y && contains(poly, p))
+			{
+				return poly.country;
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	static constexpr int cells_x = 360;
+	static constexpr int cells_y = 180;
+
+	struct point
+	{
+		float x;    // longitude
+		float y;    // latitude
+	};
+
+	struct ring
+	{
+		std::uint32_t begin;
+		std::uint32_t end;
+	};
+
+	// An outer ring and its holes; the even-odd rule over all of them
+	// gives the holes for free
+	struct polygon
+	{
+		const country_info *country;
+		point min;
+		point max;
+		std::uint32_t rings_begin;
+		std::uint32_t rings_end;
+	};
+
+	static const country_info *feature_country(const nlohmann::json &feature)
+	{
+		if (!feature.contains("properties") || !feature["properties"].is_object())
+		{
+			return nullptr;
+		}
+		const auto &properties{ feature["properties"] };
+		for (const auto *key : { "ISO_A2_EH", "ISO_A2", "iso_a2", "ISO3166-1-Alpha-2" })
+		{
+			if (properties.contains(key) && properties[key].is_string())
+			{
+				if (const auto *country{ find_country(properties[key].get<std::string>()) })
+				{
+					return country;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	static std::size_t cell_of(double lng, double lat)
+	{
+		const auto x{ std::clamp(static_cast<int>(std::floor(lng + 180.0)), 0, cells_x - 1) };
+		const auto y{ std::clamp(static_cast<int>(std::floor(lat + 90.0)), 0, cells_y - 1) };
+		return static_cast<std::size_t>(y) * cells_x + static_cast<std::size_t>(x);
+	}
+
+	void add_polygon(const country_info *country, const nlohmann::json &rings)
+	{
+		polygon poly{ country, { 180.0f, 90.0f }, { -180.0f, -90.0f },
+			static_cast<std::uint32_t>(m_rings.size()), static_cast<std::uint32_t>(m_rings.size()) };
+		std::vector<point> raw;
+		for (const auto &coordinates : rings)
+		{
+			raw.clear();
+			for (const auto &position : coordinates)
+			{
+				raw.push_back({ position[0].get<float>(), position[1].get<float>() });
+			}
+			const auto begin{ static_cast<std::uint32_t>(m_points.size()) };
+			simplify(raw);
+			if (m_points.size() - begin < 4)
+			{
+				// Smaller than the tolerance
+				m_points.resize(begin);
+				continue;
+			}
+			for (auto i{ begin }; i != m_points.size(); ++i)
+			{
+				poly.min = { std::min(poly.min.x, m_points[i].x), std::min(poly.min.y, m_points[i].y) };
+				poly.max = { std::max(poly.max.x, m_points[i].x), std::max(poly.max.y, m_points[i].y) };
+			}
+			m_rings.push_back({ begin, static_cast<std::uint32_t>(m_points.size()) });
+		}
+		poly.rings_end = static_cast<std::uint32_t>(m_rings.size());
+		if (poly.rings_end != poly.rings_begin)
+		{
+			m_polygons.push_back(poly);
+		}
+	}
+
+	// Appends the Douglas-Peucker simplification of a closed ring to m_points
+	void simplify(const std::vector<point> &raw)
+	{
+		if (raw.size() < 4)
+		{
+			return;
+		}
+		std::vector<bool> keep(raw.size(), false);
+		keep.front() = keep.back() = true;
+		std::vector<std::pair<std::size_t, std::size_t>> pending{ { 0, raw.size() - 1 } };
+		while (!pending.empty())
+		{
+			const auto [first, last]{ pending.back() };
+			pending.pop_back();
+			const double ax{ raw[first].x }, ay{ raw[first].y };
+			const double dx{ raw[last].x - ax }, dy{ raw[last].y - ay };
+			const auto length{ std::hypot(dx, dy) };
+			double farthest{ 0.0 };
+			auto index{ first };
+			for (auto i{ first + 1 }; i < last; ++i)
+			{
+				const double px{ raw[i].x - ax }, py{ raw[i].y - ay };
+				// A closed ring starts and ends on the same point, so measure from it
+				const auto distance{ length > 0.0 ? std::abs(dx * py - dy * px) / length : std::hypot(px, py) };
+				if (distance > farthest)
+				{
+					farthest = distance;
+					index = i;
+				}
+			}
+			if (farthest > simplify_tolerance)
+			{
+				keep[index] = true;
+				pending.push_back({ first, index });
+				pending.push_back({ index, last });
+			}
+		}
+		for (std::size_t i{ 0 }; i != raw.size(); ++i)
+		{
+			if (keep[i])
+			{
+				m_points.push_back(raw[i]);
+			}
+		}
+	}
+
+	// Buckets every polygon by the cells its bounding box covers, as
+	// offsets into one flat list
+	void build_grid()
+	{
+		const auto cell_range = [](const polygon &poly)
+		{
+			const auto lo{ cell_of(poly.min.x, poly.min.y) };
+			const auto hi{ cell_of(poly.max.x, poly.max.y) };
+			return std::make_pair(lo, hi);
+		};
+		const auto for_each_cell = [&cell_range](const polygon &poly, auto &&visit)
+		{
+			const auto [lo, hi]{ cell_range(poly) };
+			for (auto y{ lo / cells_x }; y <= hi / cells_x; ++y)
+			{
+				for (auto x{ lo % cells_x }; x <= hi % cells_x; ++x)
+				{
+					visit(y * cells_x + x);
+				}
+			}
+		};
+
+		m_cell_offsets.assign(std::size_t{ cells_x } * cells_y + 1, 0);
+		for (const auto &poly : m_polygons)
+		{
+			for_each_cell(poly, [this](std::size_t cell) { ++m_cell_offsets[cell + 1]; });
+		}
+		for (std::size_t i{ 1 }; i != m_cell_offsets.size(); ++i)
+		{
+			m_cell_offsets[i] += m_cell_offsets[i - 1];
+		}
+		m_cell_items.resize(m_cell_offsets.back());
+		auto next{ m_cell_offsets };
+		for (std::uint32_t i{ 0 }; i != m_polygons.size(); ++i)
+		{
+			for_each_cell(m_polygons[i], [this, &next, i](std::size_t cell) { m_cell_items[next[cell]++] = i; });
+		}
+	}
+
+	// Even-odd ray casting over all of the polygon's rings
+	bool contains(const polygon &poly, point p) const
+	{
+		bool inside{ false };
+		for (auto r{ poly.rings_begin }; r != poly.rings_end; ++r)
+		{
+			const auto &rg{ m_rings[r] };
+			for (auto i{ rg.begin }, j{ rg.end - 1 }; i != rg.end; j = i++)
+			{
+				const auto &a{ m_points[i] };
+				const auto &b{ m_points[j] };
+				if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+				{
+					inside = !inside;
+				}
+			}
+		}
+		return inside;
+	}
+
+	std::vector<point> m_points;
+	std::vector<ring> m_rings;
+	std::vector<polygon> m_polygons;
+	std::vector<std::uint32_t> m_cell_offsets;
+	std::vector<std::uint32_t> m_cell_items;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "capture.hpp"
+#include "rates.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+/*
+	Restarts without refusing a connection or starting cold.
+
+	A server started with "handoffsocket" listens on that Unix socket. A new
+	server started with the same path connects to it before binding its own
+	port, and the running server answers with one message: the descriptor
+	of its listening socket, attached with SCM_RIGHTS, and its current rate
+	snapshot and currency list, encoded as in capture files. The new server
+	adopts both, starts accepting and writes back one byte. Only then does
+	the old server close its copy of the listener and drain its sessions.
+
+	Both processes hold the same listening socket throughout, so clients
+	connecting mid-handoff wait in its backlog instead of being refused. If
+	the new server dies or hangs before acknowledging, the old one carries on.
+
+	The message is an 8-byte magic, the body's length as an 8-byte native
+	integer (both ends are on the same host) and the body: the encoded
+	rates and the currency list as length-prefixed strings, either of them
+	empty if the old server had nothing cached yet.
+*/
+
+namespace handoff
+{
+	inline constexpr std::string_view magic{ "CCHAND01" };
+
+	// How long either server waits on the other at each step
+	inline constexpr std::chrono::seconds timeout{ 5 };
+
+	// A few hundred rates and the currency list come to tens of kilobytes;
+	// a longer body isn't from a server of ours
+	inline constexpr std::uint64_t max_body{ 4 * 1024 * 1024 };
+
+	// What a new server takes over from the one it replaces
+	struct inheritance
+	{
+		int listener{ -1 };
+		std::shared_ptr<const rate_snapshot> rates;
+		std::shared_ptr<const std::string> list;
+	};
+
+#if !defined(_WIN32)
+	namespace detail
+	{
+		// A new server that dies mid-handoff mustn't take the old one with it
+#if defined(MSG_NOSIGNAL)
+		inline constexpr int send_flags = MSG_NOSIGNAL;
+#else
+		inline constexpr int send_flags = 0;
+#endif
+
+		[[noreturn]] inline void fail(const char *what)
+		{
+			throw std::system_error{ errno, std::generic_category(), what };
+		}
+	}
+
+	// Sends the listener and what's cached over a connected Unix socket;
+	// throws if the new server stops reading for longer than the timeout
+	inline void send(int socket, int listener, const std::shared_ptr<const rate_snapshot> &rates,
+		const std::shared_ptr<const std::string> &list)
+	{
+		const timeval wait{ static_cast<time_t>(timeout.count()), 0 };
+		::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof wait);
+
+		std::string body;
+		capture::detail::put_string(body, rates ? capture::recorder::encode(*rates) : std::string{});
+		capture::detail::put_string(body, list ? std::string_view{ *list } : std::string_view{});
+
+		const std::uint64_t length{ body.size() };
+		std::string message{ magic };
+		message.append(reinterpret_cast<const char *>(&length), sizeof length);
+		message += body;
+
+		// The descriptor rides along with the first byte
+		iovec first{ message.data(), 1 };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+		msghdr header{};
+		header.msg_iov = &first;
+		header.msg_iovlen = 1;
+		header.msg_control = control;
+		header.msg_controllen = sizeof control;
+		auto *cmsg{ CMSG_FIRSTHDR(&header) };
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &listener, sizeof listener);
+		if (::sendmsg(socket, &header, detail::send_flags) != 1)
+		{
+			detail::fail("handoff send");
+		}
+
+		for (std::size_t sent{ 1 }; sent != message.size();)
+		{
+			const auto n{ ::send(socket, message.data() + sent, message.size() - sent, detail::send_flags) };
+			if (n < 0 && errno != EINTR)
+			{
+				detail::fail("handoff send");
+			}
+			sent += n > 0 ? static_cast<std::size_t>(n) : 0;
+		}
+	}
+
+	// Receives what send() sent; throws if the old server doesn't answer
+	// within a few seconds or sends something else
+	inline inheritance receive(int socket)
+	{
+		const timeval wait{ static_cast<time_t>(timeout.count()), 0 };
+		::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof wait);
+
+		inheritance result;
+		char first;
+		iovec iov{ &first, 1 };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+		msghdr header{};
+		header.msg_iov = &iov;
+		header.msg_iovlen = 1;
+		header.msg_control = control;
+		header.msg_controllen = sizeof control;
+		if (::recvmsg(socket, &header, 0) != 1)
+		{
+			detail::fail("handoff receive");
+		}
+		for (auto *cmsg{ CMSG_FIRSTHDR(&header) }; cmsg; cmsg = CMSG_NXTHDR(&header, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			{
+				std::memcpy(&result.listener, CMSG_DATA(cmsg), sizeof result.listener);
+			}
+		}
+		if (result.listener < 0)
+		{
+			throw std::runtime_error{ "No listening socket in the handoff" };
+		}
+
+		// Nothing else keeps the descriptor open if the rest doesn't arrive
+		try
+		{
+			const auto read_exactly = [socket](std::string &into, std::size_t n)
+			{
+				for (std::size_t offset{ into.size() }, end{ into.size() + n }; offset != end;)
+				{
+					into.resize(end);
+					const auto got{ ::read(socket, into.data() + offset, end - offset) };
+					if (got == 0)
+					{
+						throw std::runtime_error{ "Truncated handoff" };
+					}
+					if (got < 0 && errno != EINTR)
+					{
+						detail::fail("handoff receive");
+					}
+					offset += got > 0 ? static_cast<std::size_t>(got) : 0;
+				}
+			};
+
+			std::string prefix{ first };
+			read_exactly(prefix, magic.size() - 1 + sizeof(std::uint64_t));
+			if (std::string_view{ prefix }.substr(0, magic.size()) != magic)
+			{
+				throw std::runtime_error{ "Not a handoff" };
+			}
+			std::uint64_t length;
+			std::memcpy(&length, prefix.data() + magic.size(), sizeof length);
+			if (length > max_body)
+			{
+				throw std::runtime_error{ "Not a handoff" };
+			}
+			std::string body;
+			read_exactly(body, static_cast<std::size_t>(length));
+
+			capture::detail::cursor in{ body };
+			if (const auto rates{ in.string() }; !rates.empty())
+			{
+				auto snapshot{ capture::reader::decode(rates) };
+				snapshot.precompute();
+				result.rates = std::make_shared<const rate_snapshot>(std::move(snapshot));
+			}
+			if (const auto list{ in.string() }; !list.empty())
+			{
+				result.list = std::make_shared<const std::string>(list);
+			}
+		}
+		catch (...)
+		{
+			::close(result.listener);
+			throw;
+		}
+		return result;
+	}
+
+	// Tells the old server the listener has been taken over
+	inline void acknowledge(int socket)
+	{
+		const char done{ 1 };
+		if (::send(socket, &done, 1, detail::send_flags) != 1)
+		{
+			detail::fail("handoff acknowledge");
+		}
+	}
+#endif
+}
+
+#endif
@@ -0,0 +1,473 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <boost/asio/ssl/context.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/http.hpp>
+#include <openssl/ssl.h>
+
+#include <cstdint>
+#include <string_view>
+
+#if defined(CURRENCY_CONVERTER_HTTP2)
+#include <nghttp2/nghttp2.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#endif
+
+/*
+	HTTP/2 over the TLS listener.
+
+	ALPN lets a client pick HTTP/2 during the TLS handshake; clients that
+	don't ask for it, and every client when the server is built without
+	CURRENCY_CONVERTER_HTTP2, keep using HTTP/1.1. With HTTP/2 a browser
+	sends all its requests for the page over one connection as concurrent
+	streams. nghttp2 does the framing, HPACK and flow control; session turns
+	its callbacks into Beast requests and Beast responses back into frames,
+	and leaves the reading and writing of the socket to the caller.
+*/
+
+namespace http2
+{
+	namespace http = boost::beast::http;
+
+	// Makes the server answer ALPN offers, preferring HTTP/2 when it's built in
+	inline void enable_alpn(boost::asio::ssl::context &ctx)
+	{
+		SSL_CTX_set_alpn_select_cb(ctx.native_handle(),
+			[](SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *)
+			{
+#if defined(CURRENCY_CONVERTER_HTTP2)
+				static const unsigned char protocols[]{ "\x02h2\x08http/1.1" };
+#else
+				static const unsigned char protocols[]{ "\x08http/1.1" };
+#endif
+				unsigned char *selected{ nullptr };
+				if (SSL_select_next_proto(&selected, outlen, protocols, sizeof(protocols) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+				{
+					return SSL_TLSEXT_ERR_NOACK;
+				}
+				*out = selected;
+				return SSL_TLSEXT_ERR_OK;
+			}, nullptr);
+	}
+
+	// Whether the client and server agreed on HTTP/2 during the handshake
+	inline bool negotiated(SSL *ssl)
+	{
+		const unsigned char *protocol{ nullptr };
+		unsigned int length{ 0 };
+		SSL_get0_alpn_selected(ssl, &protocol, &length);
+		return std::string_view{ reinterpret_cast<const char*>(protocol), length } == "h2";
+	}
+
+#if defined(CURRENCY_CONVERTER_HTTP2)
+	using request = http::request<http::string_body>;
+
+	// Turns a request body into a response body while the request body is
+	// still arriving; last is true on the final call, which has no input
+	using body_filter = std::function<void(std::string_view chunk, bool last, std::string &out)>;
+
+	// A response whose header is sent as soon as the request header arrives
+	// and whose body is produced by a filter over the request body
+	struct streamed_response
+	{
+		http::response_header<> header;
+		body_filter filter;
+	};
+
+	// One HTTP/2 connection's protocol state, without any I/O
+	class session
+	{
+	public:
+		// Receives each complete request that isn't streamed
+		using request_handler = std::function<void(std::int32_t stream_id, request &&req)>;
+
+		// Decides from the request header whether the request is streamed
+		using stream_router = std::function<std::optional<streamed_response>(const request &req)>;
+
+		// Requests with bodies over body_limit are reset. A streamed
+		// response holding more than max_buffered unsent bytes stops the
+		// client's window from being reopened until the reader catches up.
+		session(request_handler on_request, stream_router route, std::uint64_t body_limit, std::size_t max_buffered)
+			: m_on_request{ std::move(on_request) }, m_route{ std::move(route) }, m_body_limit{ body_limit },
+			m_max_buffered{ max_buffered }
+		{
+			nghttp2_session_callbacks *callbacks{ nullptr };
+			nghttp2_session_callbacks_new(&callbacks);
+			nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, &session::on_begin_headers);
+			nghttp2_session_callbacks_set_on_header_callback(callbacks, &session::on_header);
+			nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, &session::on_data_chunk);
+			nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, &session::on_frame);
+			nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, &session::on_stream_close);
+
+			// Window updates are sent by hand so that streamed responses get backpressure
+			nghttp2_option *options{ nullptr };
+			nghttp2_option_new(&options);
+			nghttp2_option_set_no_auto_window_update(options, 1);
+
+			nghttp2_session_server_new2(&m_session, callbacks, this, options);
+			nghttp2_option_del(options);
+			nghttp2_session_callbacks_del(callbacks);
+		}
+
+		~session()
+		{
+			nghttp2_session_del(m_session);
+		}
+
+		session(const session &) = delete;
+		session &operator=(const session &) = delete;
+
+		// Queues the server's SETTINGS frame, which has to be sent first, and
+		// widens the connection's window to match the streams'
+		void start()
+		{
+			const std::array<nghttp2_settings_entry, 3> settings{ {
+				{ NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, max_streams },
+				{ NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, window_size },
+				{ NGHTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, max_header_list }
+			} };
+			nghttp2_submit_settings(m_session, NGHTTP2_FLAG_NONE, settings.data(), settings.size());
+			nghttp2_session_set_local_window_size(m_session, NGHTTP2_FLAG_NONE, 0, window_size);
+		}
+
+		// Processes bytes read from the client; false means a protocol error,
+		// after which only the queued GOAWAY is worth sending
+		bool receive(const char *data, std::size_t size)
+		{
+			return nghttp2_session_mem_recv(m_session, reinterpret_cast<const std::uint8_t*>(data), size) >= 0;
+		}
+
+		// Appends frames waiting to be sent to out; false when there are none
+		bool pending_output(std::string &out)
+		{
+			release_windows();
+			const auto before{ out.size() };
+			for (;;)
+			{
+				const std::uint8_t *data{ nullptr };
+				const auto size{ nghttp2_session_mem_send(m_session, &data) };
+				if (size <= 0)
+				{
+					break;
+				}
+				out.append(reinterpret_cast<const char*>(data), static_cast<std::size_t>(size));
+			}
+			return out.size() != before;
+		}
+
+		// Queues a GOAWAY that lets the streams already started finish; the
+		// connection is done once they have
+		void shut_down()
+		{
+			nghttp2_submit_goaway(m_session, NGHTTP2_FLAG_NONE, nghttp2_session_get_last_proc_stream_id(m_session),
+				NGHTTP2_NO_ERROR, nullptr, 0);
+		}
+
+		// False once both sides are done with the connection
+		bool want_read() const
+		{
+			return nghttp2_session_want_read(m_session) != 0;
+		}
+
+		// Queues the response to a stream, unless the stream has been closed
+		template<class Body, class Fields>
+		void respond(std::int32_t stream_id, http::response<Body, Fields> &&res)
+		{
+			const auto found{ m_streams.find(stream_id) };
+			if (found == m_streams.end())
+			{
+				return;
+			}
+			auto &s{ found->second };
+
+			boost::beast::error_code ec;
+			typename Body::writer writer{ res.base(), res.body() };
+			writer.init(ec);
+			while (!ec)
+			{
+				const auto buffers{ writer.get(ec) };
+				if (!buffers)
+				{
+					break;
+				}
+				s.out += boost::beast::buffers_to_string(buffers->first);
+				if (!buffers->second)
+				{
+					break;
+				}
+			}
+			if (ec)
+			{
+				nghttp2_submit_rst_stream(m_session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_INTERNAL_ERROR);
+				return;
+			}
+			s.complete = true;
+			submit(stream_id, res.base(), !s.out.empty());
+		}
+
+	private:
+		static constexpr std::uint32_t max_streams = 100;
+		static constexpr std::uint32_t window_size = 1024 * 1024;
+		static constexpr std::uint32_t max_header_list = 64 * 1024;
+
+		struct stream
+		{
+			request req;
+			body_filter filter;
+			std::string out;            // response body not yet sent, from offset sent
+			std::size_t sent{ 0 };
+			std::size_t held{ 0 };      // request bytes received but not yet given back to the window
+			std::uint64_t received{ 0 };
+			bool complete{ false };     // out holds the end of the response body
+			bool deferred{ false };     // nghttp2 is waiting for more of out
+			bool rejected{ false };
+		};
+
+		static session &self(void *user_data)
+		{
+			return *static_cast<session*>(user_data);
+		}
+
+		static bool is_request_headers(const nghttp2_frame *frame)
+		{
+			return frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST;
+		}
+
+		static int on_begin_headers(nghttp2_session *, const nghttp2_frame *frame, void *user_data)
+		{
+			if (is_request_headers(frame))
+			{
+				self(user_data).m_streams[frame->hd.stream_id].req.version(20);
+			}
+			return 0;
+		}
+
+		static int on_header(nghttp2_session *, const nghttp2_frame *frame, const std::uint8_t *name, std::size_t namelen,
+			const std::uint8_t *value, std::size_t valuelen, std::uint8_t, void *user_data)
+		{
+			if (!is_request_headers(frame))
+			{
+				return 0;
+			}
+			const auto found{ self(user_data).m_streams.find(frame->hd.stream_id) };
+			if (found == self(user_data).m_streams.end())
+			{
+				return 0;
+			}
+			auto &req{ found->second.req };
+			const std::string_view n{ reinterpret_cast<const char*>(name), namelen };
+			const boost::beast::string_view v{ reinterpret_cast<const char*>(value), valuelen };
+			if (n == ":method")
+			{
+				req.method_string(v);
+			}
+			else if (n == ":path")
+			{
+				req.target(v);
+			}
+			else if (n == ":authority")
+			{
+				req.set(http::field::host, v);
+			}
+			else if (n.empty() || n.front() != ':')
+			{
+				req.insert(boost::beast::string_view{ n.data(), n.size() }, v);
+			}
+			return 0;
+		}
+
+		static int on_data_chunk(nghttp2_session *, std::uint8_t, std::int32_t stream_id, const std::uint8_t *data,
+			std::size_t len, void *user_data)
+		{
+			auto &me{ self(user_data) };
+			const auto found{ me.m_streams.find(stream_id) };
+			if (found == me.m_streams.end() || found->second.rejected)
+			{
+				me.give_back(stream_id, len);
+				return 0;
+			}
+			auto &s{ found->second };
+			const std::string_view chunk{ reinterpret_cast<const char*>(data), len };
+			if (s.filter)
+			{
+				s.filter(chunk, false, s.out);
+				s.held += len;
+				me.resume(stream_id, s);
+				return 0;
+			}
+
+			s.received += len;
+			if (s.received > me.m_body_limit)
+			{
+				s.rejected = true;
+				nghttp2_submit_rst_stream(me.m_session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+			}
+			else
+			{
+				s.req.body().append(chunk);
+			}
+			me.give_back(stream_id, len);
+			return 0;
+		}
+
+		static int on_frame(nghttp2_session *, const nghttp2_frame *frame, void *user_data)
+		{
+			auto &me{ self(user_data) };
+			const auto found{ me.m_streams.find(frame->hd.stream_id) };
+			if (found == me.m_streams.end() || found->second.rejected)
+			{
+				return 0;
+			}
+			auto &s{ found->second };
+			if (is_request_headers(frame))
+			{
+				if (auto streamed{ me.m_route(s.req) })
+				{
+					s.filter = std::move(streamed->filter);
+					me.submit(frame->hd.stream_id, streamed->header, true);
+				}
+			}
+			if ((frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA) && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+			{
+				if (s.filter)
+				{
+					s.filter({}, true, s.out);
+					s.complete = true;
+					me.resume(frame->hd.stream_id, s);
+				}
+				else
+				{
+					me.m_on_request(frame->hd.stream_id, std::move(s.req));
+				}
+			}
+			return 0;
+		}
+
+		static int on_stream_close(nghttp2_session *, std::int32_t stream_id, std::uint32_t, void *user_data)
+		{
+			self(user_data).m_streams.erase(stream_id);
+			return 0;
+		}
+
+		// Hands nghttp2 the next piece of a stream's response body
+		static ssize_t read_body(nghttp2_session *, std::int32_t stream_id, std::uint8_t *buf, std::size_t length,
+			std::uint32_t *data_flags, nghttp2_data_source *, void *user_data)
+		{
+			const auto found{ self(user_data).m_streams.find(stream_id) };
+			if (found == self(user_data).m_streams.end())
+			{
+				return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+			}
+			auto &s{ found->second };
+			const auto n{ std::min(length, s.out.size() - s.sent) };
+			std::memcpy(buf, s.out.data() + s.sent, n);
+			s.sent += n;
+			if (s.sent == s.out.size())
+			{
+				s.out.clear();
+				s.sent = 0;
+				if (s.complete)
+				{
+					*data_flags |= NGHTTP2_DATA_FLAG_EOF;
+					return static_cast<ssize_t>(n);
+				}
+			}
+			if (n == 0)
+			{
+				s.deferred = true;
+				return NGHTTP2_ERR_DEFERRED;
+			}
+			return static_cast<ssize_t>(n);
+		}
+
+		// Submits a response header, with the stream's out as the body if it has one
+		template<class Fields>
+		void submit(std::int32_t stream_id, const http::response_header<Fields> &header, bool has_body)
+		{
+			const auto status{ std::to_string(header.result_int()) };
+			std::vector<std::string> names;
+			names.reserve(static_cast<std::size_t>(std::distance(header.begin(), header.end())));
+			std::vector<nghttp2_nv> nva;
+			nva.reserve(names.capacity() + 1);
+			nva.push_back(make_nv(":status", status));
+			for (const auto &field : header)
+			{
+				// Connection-specific fields are not allowed in HTTP/2
+				const auto name{ field.name() };
+				if (name == http::field::connection || name == http::field::keep_alive || name == http::field::proxy_connection
+					|| name == http::field::transfer_encoding || name == http::field::upgrade)
+				{
+					continue;
+				}
+				auto &lower{ names.emplace_back(field.name_string().to_string()) };
+				std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+				nva.push_back(make_nv(lower, field.value()));
+			}
+
+			nghttp2_data_provider provider{};
+			provider.read_callback = &session::read_body;
+			nghttp2_submit_response(m_session, stream_id, nva.data(), nva.size(), has_body ? &provider : nullptr);
+		}
+
+		static nghttp2_nv make_nv(std::string_view name, boost::beast::string_view value)
+		{
+			return nghttp2_nv{
+				reinterpret_cast<std::uint8_t*>(const_cast<char*>(name.data())),
+				reinterpret_cast<std::uint8_t*>(const_cast<char*>(value.data())),
+				name.size(), value.size(), NGHTTP2_NV_FLAG_NONE };
+		}
+
+		// Lets nghttp2 send more of a deferred stream's body
+		void resume(std::int32_t stream_id, stream &s)
+		{
+			if (s.deferred && (s.sent != s.out.size() || s.complete))
+			{
+				s.deferred = false;
+				nghttp2_session_resume_data(m_session, stream_id);
+			}
+		}
+
+		// Reopens the client's window by len bytes
+		void give_back(std::int32_t stream_id, std::size_t len)
+		{
+			if (nghttp2_session_consume(m_session, stream_id, len) != 0)
+			{
+				nghttp2_session_consume_connection(m_session, len);
+			}
+		}
+
+		// Reopens the windows of streamed requests whose responses have caught up
+		void release_windows()
+		{
+			for (auto &[stream_id, s] : m_streams)
+			{
+				if (s.held != 0 && s.out.size() - s.sent < m_max_buffered)
+				{
+					give_back(stream_id, s.held);
+					s.held = 0;
+				}
+			}
+		}
+
+		nghttp2_session *m_session{ nullptr };
+		std::unordered_map<std::int32_t, stream> m_streams;
+		request_handler m_on_request;
+		stream_router m_route;
+		const std::uint64_t m_body_limit;
+		const std::size_t m_max_buffered;
+	};
+#endif
+}
+
+#endif
@@ -0,0 +1,565 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <boost/system/error_code.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+	Asynchronous binary logger.
+
+	Request threads never format text or touch a stream. Each thread that logs
+	owns a single-producer/single-consumer ring of fixed-size records holding a
+	timestamp, an event ID and the raw arguments. A background thread drains all
+	rings, formats the records and writes them to stderr in one batch. When a
+	ring is full the record is dropped and counted instead of waiting, and each
+	event ID is rate limited so a flood of identical errors can't crowd out the
+	rest of the log.
+*/
+
+namespace logging
+{
+	enum class level : std::uint8_t
+	{
+		debug,
+		info,
+		warning,
+		error
+	};
+
+	// Every message the server can log. The format string for each one
+	// lives in the event_info table below, indexed by the enumerator.
+	enum class event : std::uint16_t
+	{
+		server_start,
+		fatal_error,
+		io_failure,
+		upstream_failure,
+		session_failure,
+		rates_refreshed,
+		rate_limited,
+		took_over,
+		handed_off,
+		drained,
+		quota_mismatch,
+		count
+	};
+
+	struct event_info
+	{
+		level severity;
+		const char *format;
+	};
+
+	// "{}" placeholders are replaced by the record's arguments in order
+	inline constexpr std::array<event_info, static_cast<std::size_t>(event::count)> events{ {
+		{ level::info, "Starting server at {}:{}..." },
+		{ level::error, "Fatal error: {}" },
+		{ level::error, "{}: {}" },
+		{ level::error, "Upstream query for '{}' failed: {}" },
+		{ level::error, "Session failed: {}" },
+		{ level::info, "Refreshed {} rates published at {}; next refresh in {}s, {} API requests used this month" },
+		{ level::warning, "Rate limited {} on {} routes" },
+		{ level::info, "Took over the listener from the previous server, with {} cached rates" },
+		{ level::info, "Handed the listener to a new server; draining {} sessions for up to {}s" },
+		{ level::info, "Stopping with {} sessions still open" },
+		{ level::warning, "currencyquota is {} requests but the API reports {}; using {}" }
+	} };
+
+	namespace detail
+	{
+		constexpr std::size_t max_args = 4;
+		constexpr std::size_t text_capacity = 64;
+		constexpr std::size_t ring_capacity = 256;     // records per thread, must be a power of two
+		constexpr std::size_t cache_line = 64;
+
+		enum class arg_type : std::uint8_t
+		{
+			none,
+			integer,
+			unsigned_integer,
+			floating,
+			text,
+			error_code
+		};
+
+		union arg_value
+		{
+			std::int64_t i;
+			std::uint64_t u;
+			double d;
+			struct
+			{
+				std::uint16_t offset;
+				std::uint16_t length;
+			} text;
+			struct
+			{
+				int value;
+				const boost::system::error_category *category;
+			} ec;
+		};
+
+		// One log entry. Strings are copied into the inline text buffer
+		// so the record never points at memory owned by the caller.
+		struct record
+		{
+			std::uint64_t timestamp;               // nanoseconds since the Unix epoch
+			event id;
+			std::uint8_t argc;
+			std::uint8_t text_used;
+			std::array<arg_type, max_args> types;
+			std::array<arg_value, max_args> args;
+			char text[text_capacity];
+		};
+
+		// Fixed-capacity SPSC queue; the owning thread pushes, the drain thread pops
+		class ring
+		{
+		public:
+			bool push(const record &r)
+			{
+				const auto head{ m_head.load(std::memory_order_relaxed) };
+				if (head - m_tail.load(std::memory_order_acquire) == ring_capacity)
+				{
+					return false;
+				}
+				m_records[head & (ring_capacity - 1)] = r;
+				m_head.store(head + 1, std::memory_order_release);
+				return true;
+			}
+
+			bool pop(record &r)
+			{
+				const auto tail{ m_tail.load(std::memory_order_relaxed) };
+				if (tail == m_head.load(std::memory_order_acquire))
+				{
+					return false;
+				}
+				r = m_records[tail & (ring_capacity - 1)];
+				m_tail.store(tail + 1, std::memory_order_release);
+				return true;
+			}
+
+			bool empty() const
+			{
+				return m_tail.load(std::memory_order_relaxed) == m_head.load(std::memory_order_acquire);
+			}
+
+			// Set when the owning thread exits; the drain thread frees the
+			// ring once it has been emptied
+			std::atomic<bool> retired{ false };
+
+		private:
+			alignas(cache_line) std::atomic<std::size_t> m_head{ 0 };
+			alignas(cache_line) std::atomic<std::size_t> m_tail{ 0 };
+			alignas(cache_line) std::array<record, ring_capacity> m_records;
+		};
+
+		// Per-event-ID rate limiter state, one cache line each so that
+		// unrelated events don't contend
+		struct alignas(cache_line) limiter
+		{
+			std::atomic<std::uint64_t> window{ 0 };     // second the current count belongs to
+			std::atomic<std::uint32_t> count{ 0 };
+			std::atomic<std::uint64_t> suppressed{ 0 };
+		};
+
+		inline void pack(record &r, std::size_t i, std::string_view s)
+		{
+			const auto length{ std::min<std::size_t>(s.size(), text_capacity - r.text_used) };
+			std::memcpy(r.text + r.text_used, s.data(), length);
+			r.types[i] = arg_type::text;
+			r.args[i].text.offset = r.text_used;
+			r.args[i].text.length = static_cast<std::uint16_t>(length);
+			r.text_used = static_cast<std::uint8_t>(r.text_used + length);
+		}
+
+		inline void pack(record &r, std::size_t i, const char *s)
+		{
+			pack(r, i, std::string_view{ s });
+		}
+
+		inline void pack(record &r, std::size_t i, const std::string &s)
+		{
+			pack(r, i, std::string_view{ s });
+		}
+
+		inline void pack(record &r, std::size_t i, const boost::system::error_code &ec)
+		{
+			r.types[i] = arg_type::error_code;
+			r.args[i].ec.value = ec.value();
+			r.args[i].ec.category = &ec.category();
+		}
+
+		template<class T, class = std::enable_if_t<std::is_arithmetic_v<T>>>
+		void pack(record &r, std::size_t i, T value)
+		{
+			if constexpr (std::is_floating_point_v<T>)
+			{
+				r.types[i] = arg_type::floating;
+				r.args[i].d = value;
+			}
+			else if constexpr (std::is_signed_v<T>)
+			{
+				r.types[i] = arg_type::integer;
+				r.args[i].i = value;
+			}
+			else
+			{
+				r.types[i] = arg_type::unsigned_integer;
+				r.args[i].u = value;
+			}
+		}
+	}
+
+	// Owns the per-thread rings and the drain thread
+	class logger
+	{
+	public:
+		static logger &instance()
+		{
+			static logger log;
+			return log;
+		}
+
+		// Starts the background thread; records logged before this are
+		// kept in their rings until it runs
+		void start()
+		{
+			if (!m_running.exchange(true))
+			{
+				m_thread = std::thread{ [this] { run(); } };
+			}
+		}
+
+		// Drains whatever is left and joins the background thread
+		void stop()
+		{
+			if (m_running.exchange(false))
+			{
+				m_thread.join();
+			}
+		}
+
+		void set_level(level threshold)
+		{
+			m_threshold.store(threshold, std::memory_order_relaxed);
+		}
+
+		// Maximum records per second for any single event ID
+		void set_rate_limit(std::uint32_t per_second)
+		{
+			m_rate_limit.store(per_second, std::memory_order_relaxed);
+		}
+
+		// Records lost because a ring was full, since startup
+		std::uint64_t dropped() const
+		{
+			return m_dropped_total.load(std::memory_order_relaxed);
+		}
+
+		template<class... Args>
+		void log(event id, const Args &...args)
+		{
+			static_assert(sizeof...(Args) <= detail::max_args, "too many log arguments");
+			const auto &info{ events[static_cast<std::size_t>(id)] };
+			if (info.severity < m_threshold.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			const auto now{ static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count()) };
+			if (!admit(id, now / 1'000'000'000))
+			{
+				return;
+			}
+
+			detail::record r;
+			r.timestamp = now;
+			r.id = id;
+			r.argc = static_cast<std::uint8_t>(sizeof...(Args));
+			r.text_used = 0;
+			r.types.fill(detail::arg_type::none);
+			std::size_t i{ 0 };
+			(detail::pack(r, i++, args), ...);
+
+			if (!local_ring().push(r))
+			{
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+				m_dropped_total.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		logger(const logger &) = delete;
+		logger &operator=(const logger &) = delete;
+
+	private:
+		logger() = default;
+
+		~logger()
+		{
+			stop();
+		}
+
+		// Holds the calling thread's ring and retires it when the thread exits
+		struct ring_owner
+		{
+			std::shared_ptr<detail::ring> ring;
+
+			~ring_owner()
+			{
+				if (ring)
+				{
+					ring->retired.store(true, std::memory_order_release);
+				}
+			}
+		};
+
+		detail::ring &local_ring()
+		{
+			thread_local ring_owner owner;
+			if (!owner.ring)
+			{
+				// Only taken once per thread, the first time it logs
+				owner.ring = std::make_shared<detail::ring>();
+				std::lock_guard<std::mutex> lock{ m_rings_mutex };
+				m_rings.push_back(owner.ring);
+			}
+			return *owner.ring;
+		}
+
+		// Per-event rate limiting over one-second windows
+		bool admit(event id, std::uint64_t second)
+		{
+			auto &state{ m_limiters[static_cast<std::size_t>(id)] };
+			auto window{ state.window.load(std::memory_order_relaxed) };
+			if (window != second && state.window.compare_exchange_strong(window, second, std::memory_order_relaxed))
+			{
+				state.count.store(0, std::memory_order_relaxed);
+			}
+			if (state.count.fetch_add(1, std::memory_order_relaxed) >= m_rate_limit.load(std::memory_order_relaxed))
+			{
+				state.suppressed.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			return true;
+		}
+
+		void run()
+		{
+			std::string batch;
+			std::vector<std::shared_ptr<detail::ring>> rings;
+			for (;;)
+			{
+				const bool running{ m_running.load(std::memory_order_acquire) };
+				{
+					std::lock_guard<std::mutex> lock{ m_rings_mutex };
+					rings = m_rings;
+				}
+
+				batch.clear();
+				detail::record r;
+				for (const auto &ring : rings)
+				{
+					while (ring->pop(r))
+					{
+						format(batch, r);
+					}
+				}
+				rings.clear();
+				report_losses(batch);
+
+				if (!batch.empty())
+				{
+					std::fwrite(batch.data(), 1, batch.size(), stderr);
+					std::fflush(stderr);
+				}
+				collect_retired();
+
+				if (!running)
+				{
+					break;
+				}
+				if (batch.empty())
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds{ 5 });
+				}
+			}
+		}
+
+		// Rings are only ever popped by this thread, so a retired ring that
+		// is empty now will stay empty
+		void collect_retired()
+		{
+			std::lock_guard<std::mutex> lock{ m_rings_mutex };
+			m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(), [](const auto &ring)
+				{
+					return ring->retired.load(std::memory_order_acquire) && ring->empty();
+				}), m_rings.end());
+		}
+
+		void report_losses(std::string &batch)
+		{
+			if (const auto dropped{ m_dropped.exchange(0, std::memory_order_relaxed) }; dropped != 0)
+			{
+				append_time(batch, now_ns());
+				batch += " [warning] logger: dropped " + std::to_string(dropped) + " record(s), ring full\n";
+			}
+			for (std::size_t i{ 0 }; i < m_limiters.size(); ++i)
+			{
+				if (const auto suppressed{ m_limiters[i].suppressed.exchange(0, std::memory_order_relaxed) }; suppressed != 0)
+				{
+					append_time(batch, now_ns());
+					batch += " [warning] logger: suppressed " + std::to_string(suppressed) +
+						" repeat(s) of \"" + events[i].format + "\"\n";
+				}
+			}
+		}
+
+		static std::uint64_t now_ns()
+		{
+			return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count());
+		}
+
+		static void append_time(std::string &out, std::uint64_t timestamp)
+		{
+			const auto seconds{ static_cast<std::time_t>(timestamp / 1'000'000'000) };
+			std::tm tm{};
+#if defined(_WIN32)
+			gmtime_s(&tm, &seconds);
+#else
+			gmtime_r(&seconds, &tm);
+#endif
+			char buffer[32];
+			const auto length{ std::snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ",
+				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+				static_cast<unsigned>(timestamp % 1'000'000'000 / 1'000)) };
+			out.append(buffer, static_cast<std::size_t>(length));
+		}
+
+		static void format(std::string &out, const detail::record &r)
+		{
+			static constexpr const char *level_names[]{ "debug", "info", "warning", "error" };
+			const auto &info{ events[static_cast<std::size_t>(r.id)] };
+			append_time(out, r.timestamp);
+			out += " [";
+			out += level_names[static_cast<std::size_t>(info.severity)];
+			out += "] ";
+
+			std::size_t arg{ 0 };
+			for (const char *p{ info.format }; *p != '\0'; ++p)
+			{
+				if (p[0] == '{' && p[1] == '}' && arg < r.argc)
+				{
+					format_arg(out, r, arg++);
+					++p;
+				}
+				else
+				{
+					out += *p;
+				}
+			}
+			out += '\n';
+		}
+
+		static void format_arg(std::string &out, const detail::record &r, std::size_t i)
+		{
+			const auto &value{ r.args[i] };
+			switch (r.types[i])
+			{
+			case detail::arg_type::integer:
+				out += std::to_string(value.i);
+				break;
+			case detail::arg_type::unsigned_integer:
+				out += std::to_string(value.u);
+				break;
+			case detail::arg_type::floating:
+				out += std::to_string(value.d);
+				break;
+			case detail::arg_type::text:
+				out.append(r.text + value.text.offset, value.text.length);
+				break;
+			case detail::arg_type::error_code:
+				out += value.ec.category->message(value.ec.value);
+				break;
+			case detail::arg_type::none:
+				break;
+			}
+		}
+
+		std::atomic<bool> m_running{ false };
+		std::atomic<level> m_threshold{ level::info };
+		std::atomic<std::uint32_t> m_rate_limit{ 10 };
+		std::atomic<std::uint64_t> m_dropped{ 0 };
+		std::atomic<std::uint64_t> m_dropped_total{ 0 };
+		std::array<detail::limiter, static_cast<std::size_t>(event::count)> m_limiters;
+		std::mutex m_rings_mutex;
+		std::vector<std::shared_ptr<detail::ring>> m_rings;
+		std::thread m_thread;
+	};
+
+	template<class... Args>
+	void log(event id, const Args &...args)
+	{
+		logger::instance().log(id, args...);
+	}
+
+	// Parses a level name as given in the "loglevel" environment variable
+	inline level parse_level(std::string_view name, level fallback)
+	{
+		if (name == "debug")
+		{
+			return level::debug;
+		}
+		if (name == "info")
+		{
+			return level::info;
+		}
+		if (name == "warning")
+		{
+			return level::warning;
+		}
+		if (name == "error")
+		{
+			return level::error;
+		}
+		return fallback;
+	}
+
+	// Starts the logger for the lifetime of the object and flushes it
+	// on the way out, including when main() returns from a catch block
+	class scope
+	{
+	public:
+		scope()
+		{
+			logger::instance().start();
+		}
+
+		~scope()
+		{
+			logger::instance().stop();
+		}
+
+		scope(const scope &) = delete;
+		scope &operator=(const scope &) = delete;
+	};
+}
+
+#endif
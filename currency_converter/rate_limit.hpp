@@ -0,0 +1,241 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <boost/asio/ip/address.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/*
+	Per-client rate limiting.
+
+	Every client address has a token bucket for each class of route, so a
+	client that loops on conversions doesn't lose access to the page itself.
+	IPv6 clients are limited per /64, the block a single subscriber usually
+	gets. Buckets live in a hash table split into cache-line-aligned shards
+	with a lock each, so a check is one hash, one uncontended lock and a few
+	arithmetic operations. There is no sweeper thread: a shard drops the
+	buckets that have been idle long enough to refill completely when it's
+	next used after sweep_interval, or after a second when it is full.
+*/
+
+// The classes of route that get separate limits
+enum class route_class : std::uint8_t
+{
+	static_file,
+	list,
+	convert,
+	batch,
+	count
+};
+
+inline constexpr std::array<std::string_view, static_cast<std::size_t>(route_class::count)> route_class_names{
+	"static",
+	"list",
+	"convert",
+	"batch"
+};
+
+// Sustained requests per second and the burst allowed on top; a rate of 0 means no limit
+struct rate_limit
+{
+	double rate;
+	double burst;
+};
+
+class rate_limiter
+{
+public:
+	using limits = std::array<rate_limit, static_cast<std::size_t>(route_class::count)>;
+
+	// Enough for a page load or two a second, a few conversions a second,
+	// and a large CSV upload every minute
+	static constexpr limits default_limits{ {
+		{ 20.0, 100.0 },
+		{ 1.0, 10.0 },
+		{ 2.0, 20.0 },
+		{ 1.0 / 60.0, 3.0 }
+	} };
+
+	explicit rate_limiter(const limits &configured = default_limits)
+		: m_limits{ configured }
+	{
+	}
+
+	// Overrides the defaults from a spec like "convert=5/50,batch=0/0",
+	// class=rate/burst separated by commas. A rate of 0 turns the limit off;
+	// otherwise the burst must be at least one request. Throws
+	// std::invalid_argument for any other entry.
+	static limits parse(std::string_view spec, limits result = default_limits)
+	{
+		const auto number = [](std::string_view text, double &value)
+		{
+			const auto [end, ec]{ std::from_chars(text.data(), text.data() + text.size(), value) };
+			return ec == std::errc{} && end == text.data() + text.size() && std::isfinite(value);
+		};
+
+		while (!spec.empty())
+		{
+			const auto comma{ spec.find(',') };
+			const auto entry{ spec.substr(0, comma) };
+			spec = comma == std::string_view::npos ? std::string_view{} : spec.substr(comma + 1);
+			if (entry.empty())
+			{
+				continue;
+			}
+
+			const auto equals{ entry.find('=') };
+			const auto slash{ entry.find('/') };
+			const auto name{ entry.substr(0, equals) };
+			const auto found{ std::find(route_class_names.begin(), route_class_names.end(), name) };
+			rate_limit parsed{};
+			if (equals == std::string_view::npos || slash == std::string_view::npos || slash < equals ||
+				found == route_class_names.end() ||
+				!number(entry.substr(equals + 1, slash - equals - 1), parsed.rate) ||
+				!number(entry.substr(slash + 1), parsed.burst) ||
+				parsed.rate < 0.0 || (parsed.rate > 0.0 && parsed.burst < 1.0))
+			{
+				throw std::invalid_argument{ "Invalid ratelimit entry: " + std::string{ entry } };
+			}
+			result[static_cast<std::size_t>(found - route_class_names.begin())] = parsed;
+		}
+		return result;
+	}
+
+	// Takes a token from the client's bucket for the route class. Returns 0
+	// if the request may go ahead, otherwise the whole seconds until a
+	// token will be available.
+	std::uint32_t acquire(const boost::asio::ip::address &client, route_class what,
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+	{
+		const auto &limit{ m_limits[static_cast<std::size_t>(what)] };
+		if (limit.rate <= 0.0)
+		{
+			return 0;
+		}
+
+		const auto k{ make_key(client, what) };
+		const auto h{ key_hash{}(k) };
+		auto &s{ m_shards[h >> (64 - shard_bits)] };
+		std::lock_guard<std::mutex> lock{ s.mutex };
+
+		const bool full{ s.buckets.size() >= max_buckets_per_shard };
+		if (now - s.last_sweep > (full ? full_sweep_interval : sweep_interval))
+		{
+			sweep(s, now);
+		}
+		if (s.buckets.size() >= max_buckets_per_shard && s.buckets.find(k) == s.buckets.end())
+		{
+			// Every client in the shard is active; let the request through untracked
+			return 0;
+		}
+
+		const auto [found, inserted]{ s.buckets.try_emplace(k, bucket{ limit.burst, now }) };
+		auto &b{ found->second };
+		if (!inserted)
+		{
+			const std::chrono::duration<double> elapsed{ now - b.updated };
+			b.tokens = std::min(limit.burst, b.tokens + elapsed.count() * limit.rate);
+			b.updated = now;
+		}
+		if (b.tokens >= 1.0)
+		{
+			b.tokens -= 1.0;
+			return 0;
+		}
+		return static_cast<std::uint32_t>(std::ceil((1.0 - b.tokens) / limit.rate));
+	}
+
+	rate_limiter(const rate_limiter &) = delete;
+	rate_limiter &operator=(const rate_limiter &) = delete;
+
+private:
+	static constexpr unsigned shard_bits = 6;
+	static constexpr std::size_t max_buckets_per_shard = 4096;
+	static constexpr std::chrono::seconds sweep_interval{ 60 };
+	static constexpr std::chrono::seconds full_sweep_interval{ 1 };
+
+	struct key
+	{
+		std::array<std::uint8_t, 16> address;
+		route_class what;
+
+		bool operator==(const key &) const = default;
+	};
+
+	struct key_hash
+	{
+		std::uint64_t operator()(const key &k) const
+		{
+			std::uint64_t hi, lo;
+			std::memcpy(&hi, k.address.data(), sizeof hi);
+			std::memcpy(&lo, k.address.data() + sizeof hi, sizeof lo);
+			auto h{ (hi * 0x9E3779B97F4A7C15ull) ^ (lo + static_cast<std::uint64_t>(k.what)) };
+			h ^= h >> 32;
+			h *= 0xD6E8FEB86659FD93ull;
+			h ^= h >> 32;
+			return h;
+		}
+	};
+
+	struct bucket
+	{
+		double tokens;
+		std::chrono::steady_clock::time_point updated;
+	};
+
+	struct alignas(64) shard
+	{
+		std::mutex mutex;
+		std::chrono::steady_clock::time_point last_sweep{};
+		std::unordered_map<key, bucket, key_hash> buckets;
+	};
+
+	static key make_key(const boost::asio::ip::address &client, route_class what)
+	{
+		key k{ {}, what };
+		const auto v4_mapped{ client.is_v6() && client.to_v6().is_v4_mapped() };
+		if (client.is_v4() || v4_mapped)
+		{
+			const auto v4{ v4_mapped ? boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, client.to_v6()) : client.to_v4() };
+			const auto bytes{ v4.to_bytes() };
+			std::copy(bytes.begin(), bytes.end(), k.address.begin());
+		}
+		else
+		{
+			// One subscriber's /64
+			const auto bytes{ client.to_v6().to_bytes() };
+			std::copy(bytes.begin(), bytes.begin() + 8, k.address.begin());
+			k.address[15] = 6;
+		}
+		return k;
+	}
+
+	// Drops buckets that would have refilled to their burst by now, since
+	// a fresh bucket is the same as one of those
+	void sweep(shard &s, std::chrono::steady_clock::time_point now) const
+	{
+		s.last_sweep = now;
+		std::erase_if(s.buckets, [this, now](const auto &entry)
+			{
+				const auto &limit{ m_limits[static_cast<std::size_t>(entry.first.what)] };
+				const std::chrono::duration<double> idle{ now - entry.second.updated };
+				return entry.second.tokens + idle.count() * limit.rate >= limit.burst;
+			});
+	}
+
+	const limits m_limits;
+	std::array<shard, std::size_t{ 1 } << shard_bits> m_shards;
+};
+
+#endif
@@ -0,0 +1,589 @@
+#ifndef RATES_H
+#define RATES_H
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+	Exchange rate snapshots and the schedule for refreshing them.
+
+	A snapshot is an immutable copy of the whole rate table from one fetch of
+	the currency API. Sessions read the current snapshot without waiting;
+	the background refresher builds the next one and swaps it in.
+
+	rate_table_parser builds a snapshot straight from the API's latest.json
+	body as it arrives, a chunk at a time, without a JSON DOM in between.
+	Once the table is complete the snapshot precomputes the rate between
+	every pair of currencies, so a conversion never divides, and the JSON
+	list of its codes, so answers that cover every currency don't
+	serialize them again.
+
+	The refresh schedule follows the provider's publish times and the monthly
+	request quota of the API plan: it fetches shortly after the next expected
+	publish, spreads the remaining requests over what's left of the month when
+	the budget runs low, and backs off exponentially with jitter on failures.
+*/
+
+// Packs a three-letter currency code into an integer that sorts the same way
+// the code does. Returns nothing for anything that isn't three letters.
+inline std::optional<std::uint32_t> pack_code(std::string_view code)
+{
+	if (code.size() != 3)
+	{
+		return std::nullopt;
+	}
+	std::uint32_t packed{ 0 };
+	for (const char c : code)
+	{
+		const auto upper{ static_cast<char>(c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c) };
+		if (upper < 'A' || upper > 'Z')
+		{
+			return std::nullopt;
+		}
+		packed = (packed << 8) | static_cast<std::uint8_t>(upper);
+	}
+	return packed;
+}
+
+inline std::string unpack_code(std::uint32_t packed)
+{
+	return { static_cast<char>(packed >> 16), static_cast<char>((packed >> 8) & 0xff), static_cast<char>(packed & 0xff) };
+}
+
+// The rate between every pair of currencies in a snapshot. Row i holds the
+// units of each currency per unit of currency i. Rows are padded to a whole
+// number of cache lines and the storage is cache-line aligned, so the loops
+// over a row run over whole vectors with no remainder to handle, which lets
+// compilers vectorize them at their default optimization levels.
+class cross_rate_matrix
+{
+public:
+	static constexpr std::size_t alignment = 64;
+
+	cross_rate_matrix() = default;
+
+	// Fills row i with per_usd[j] / per_usd[i], one division pass per row
+	explicit cross_rate_matrix(const std::vector<double> &per_usd)
+		: m_size{ per_usd.size() }, m_stride{ (per_usd.size() + per_line - 1) / per_line * per_line },
+		m_values{ allocate((m_size + 1) * m_stride) }
+	{
+		// The last row holds the rates per dollar, padded with ones
+		double *__restrict usd{ std::assume_aligned<alignment>(m_values.get() + m_size * m_stride) };
+		std::copy(per_usd.begin(), per_usd.end(), usd);
+		std::fill(usd + m_size, usd + m_stride, 1.0);
+		for (std::size_t i{ 0 }; i != m_size; ++i)
+		{
+			double *__restrict out{ std::assume_aligned<alignment>(m_values.get() + i * m_stride) };
+			const auto base{ usd[i] };
+			for (std::size_t line{ 0 }; line != m_stride; line += per_line)
+			{
+				for (std::size_t j{ line }; j != line + per_line; ++j)
+				{
+					out[j] = usd[j] / base;
+				}
+			}
+		}
+	}
+
+	// The number of currencies
+	std::size_t size() const
+	{
+		return m_size;
+	}
+
+	// The number of values in a padded row
+	std::size_t stride() const
+	{
+		return m_stride;
+	}
+
+	// Units of every currency per unit of currency i
+	const double *row(std::size_t i) const
+	{
+		return std::assume_aligned<alignment>(m_values.get() + i * m_stride);
+	}
+
+	// Units of currency to per unit of currency from
+	double operator()(std::size_t from, std::size_t to) const
+	{
+		return m_values[from * m_stride + to];
+	}
+
+	// Writes amount in every currency to out, which has room for stride()
+	// values; the ones past size() are padding
+	void convert(std::size_t from, double amount, double *__restrict out) const
+	{
+		const double *__restrict rates{ row(from) };
+		for (std::size_t line{ 0 }; line != m_stride; line += per_line)
+		{
+			for (std::size_t j{ line }; j != line + per_line; ++j)
+			{
+				out[j] = amount * rates[j];
+			}
+		}
+	}
+
+private:
+	static constexpr std::size_t per_line = alignment / sizeof(double);
+
+	static double *allocate(std::size_t count)
+	{
+		return static_cast<double *>(::operator new(count * sizeof(double), std::align_val_t{ alignment }));
+	}
+
+	struct aligned_delete
+	{
+		void operator()(double *p) const
+		{
+			::operator delete(p, std::align_val_t{ alignment });
+		}
+	};
+
+	std::size_t m_size{ 0 };
+	std::size_t m_stride{ 0 };
+	std::unique_ptr<double[], aligned_delete> m_values;
+};
+
+// Every rate from one fetch of the currency API, relative to US dollars
+struct rate_snapshot
+{
+	// When the provider published these rates, in Unix seconds
+	std::int64_t timestamp{ 0 };
+
+	// Packed currency codes in ascending order, and the matching number
+	// of units of each currency per US dollar
+	std::vector<std::uint32_t> codes;
+	std::vector<double> rates;
+
+	// Filled in by precompute() once codes and rates are complete
+	cross_rate_matrix cross;
+	std::string codes_json;     // ["AED","AFN",...]
+
+	// Builds the cross rates and the JSON code list from the table
+	void precompute()
+	{
+		cross = cross_rate_matrix{ rates };
+		codes_json.assign(1, '[');
+		codes_json.reserve(codes.size() * 6 + 1);
+		for (const auto code : codes)
+		{
+			codes_json.append(codes_json.size() == 1 ? "\"" : ",\"").append(unpack_code(code)).push_back('"');
+		}
+		codes_json.push_back(']');
+	}
+
+	std::optional<std::size_t> index_of(std::string_view code) const
+	{
+		const auto packed{ pack_code(code) };
+		if (!packed)
+		{
+			return std::nullopt;
+		}
+		const auto found{ std::lower_bound(codes.begin(), codes.end(), *packed) };
+		if (found == codes.end() || *found != *packed)
+		{
+			return std::nullopt;
+		}
+		return static_cast<std::size_t>(found - codes.begin());
+	}
+
+	std::optional<double> rate(std::string_view code) const
+	{
+		const auto i{ index_of(code) };
+		if (!i)
+		{
+			return std::nullopt;
+		}
+		return rates[*i];
+	}
+};
+
+// Incremental parser for the body of a latest.json response:
+//   { "disclaimer": ..., "license": ..., "timestamp": 1700000000, "base": "USD", "rates": { "AED": 3.6725, ... } }
+// It's fed the body in whatever chunks the network delivers and only keeps the
+// current token, so its memory use doesn't depend on the size of the body.
+// Values it doesn't need are skipped whatever their type, and strings longer
+// than a token are truncated since no key or value it keeps is that long.
+// Throws std::runtime_error on input that isn't well-formed.
+class rate_table_parser
+{
+public:
+	rate_table_parser()
+		: m_snapshot{ std::make_shared<rate_snapshot>() }
+	{
+		m_snapshot->codes.reserve(expected_currencies);
+		m_snapshot->rates.reserve(expected_currencies);
+	}
+
+	void feed(std::string_view chunk)
+	{
+		for (std::size_t i{ 0 }; i < chunk.size(); ++i)
+		{
+			const char c{ chunk[i] };
+			switch (m_mode)
+			{
+			case mode::string:
+				if (c == '\\')
+				{
+					m_mode = mode::escape;
+				}
+				else if (c == '"')
+				{
+					m_mode = mode::structure;
+					on_string();
+				}
+				else
+				{
+					append(c);
+				}
+				break;
+			case mode::escape:
+				// Escaped characters are kept as written; none of the
+				// strings this parser looks at contain any
+				append(c);
+				m_mode = mode::string;
+				break;
+			case mode::scalar:
+				if (c != ',' && c != '}' && c != ']' && c != ':' && !is_space(c))
+				{
+					append(c);
+					break;
+				}
+				m_mode = mode::structure;
+				on_scalar();
+				structure(c);
+				break;
+			case mode::structure:
+				structure(c);
+				break;
+			}
+		}
+	}
+
+	// Returns the finished snapshot once the whole body has been fed
+	std::shared_ptr<rate_snapshot> finish()
+	{
+		if (m_mode != mode::structure || m_depth != 0 || !m_closed)
+		{
+			throw std::runtime_error{ "Rate table ended early" };
+		}
+		if (!m_timestamp || m_snapshot->rates.empty())
+		{
+			throw std::runtime_error{ "Rate table has no timestamp or rates" };
+		}
+		m_snapshot->timestamp = *m_timestamp;
+		sort_by_code();
+		rebase();
+		m_snapshot->precompute();
+		return std::move(m_snapshot);
+	}
+
+private:
+	enum class mode
+	{
+		structure,
+		string,
+		escape,
+		scalar
+	};
+
+	static constexpr std::size_t expected_currencies = 192;
+	static constexpr std::size_t token_capacity = 32;
+	static constexpr int max_depth = 63;
+
+	static bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	void append(char c)
+	{
+		if (m_token.size() < token_capacity)
+		{
+			m_token += c;
+		}
+	}
+
+	bool in_object() const
+	{
+		return m_depth > 0 && (m_objects >> m_depth & 1) != 0;
+	}
+
+	void structure(char c)
+	{
+		switch (c)
+		{
+		case '{':
+		case '[':
+			if (m_closed || ++m_depth > max_depth)
+			{
+				throw std::runtime_error{ "Malformed rate table" };
+			}
+			m_objects = c == '{' ? m_objects | (std::uint64_t{ 1 } << m_depth) : m_objects & ~(std::uint64_t{ 1 } << m_depth);
+			m_expect_key = c == '{';
+			break;
+		case '}':
+		case ']':
+			if (m_depth == 0 || in_object() != (c == '}'))
+			{
+				throw std::runtime_error{ "Malformed rate table" };
+			}
+			m_closed = --m_depth == 0;
+			break;
+		case ':':
+			m_expect_key = false;
+			break;
+		case ',':
+			m_expect_key = in_object();
+			break;
+		case '"':
+			m_mode = mode::string;
+			m_token.clear();
+			break;
+		default:
+			if (!is_space(c))
+			{
+				m_mode = mode::scalar;
+				m_token.assign(1, c);
+			}
+			break;
+		}
+	}
+
+	void on_string()
+	{
+		if (in_object() && m_expect_key)
+		{
+			if (m_depth == 1)
+			{
+				m_top_key = m_token;
+			}
+			else if (m_depth == 2)
+			{
+				m_key = m_token;
+			}
+		}
+		else if (m_depth == 1 && m_top_key == "base")
+		{
+			m_base = m_token;
+		}
+	}
+
+	void on_scalar()
+	{
+		const auto first{ m_token.data() };
+		const auto last{ m_token.data() + m_token.size() };
+		if (m_depth == 1 && m_top_key == "timestamp")
+		{
+			std::int64_t timestamp{ 0 };
+			if (std::from_chars(first, last, timestamp).ec != std::errc{})
+			{
+				throw std::runtime_error{ "Malformed timestamp in rate table" };
+			}
+			m_timestamp = timestamp;
+		}
+		else if (m_depth == 2 && m_top_key == "rates" && in_object())
+		{
+			double rate{ 0.0 };
+			const auto code{ pack_code(m_key) };
+			if (code && std::from_chars(first, last, rate).ec == std::errc{})
+			{
+				m_snapshot->codes.push_back(*code);
+				m_snapshot->rates.push_back(rate);
+			}
+		}
+	}
+
+	// The API sends the codes in alphabetical order, so this is normally a no-op
+	void sort_by_code()
+	{
+		auto &codes{ m_snapshot->codes };
+		auto &rates{ m_snapshot->rates };
+		if (std::is_sorted(codes.begin(), codes.end()))
+		{
+			return;
+		}
+		std::vector<std::size_t> order(codes.size());
+		std::iota(order.begin(), order.end(), std::size_t{ 0 });
+		std::sort(order.begin(), order.end(), [&codes](std::size_t a, std::size_t b) { return codes[a] < codes[b]; });
+		std::vector<std::uint32_t> sorted_codes(codes.size());
+		std::vector<double> sorted_rates(rates.size());
+		for (std::size_t i{ 0 }; i < order.size(); ++i)
+		{
+			sorted_codes[i] = codes[order[i]];
+			sorted_rates[i] = rates[order[i]];
+		}
+		codes = std::move(sorted_codes);
+		rates = std::move(sorted_rates);
+	}
+
+	// Paid plans can have a base other than USD; snapshots are always per US dollar
+	void rebase()
+	{
+		if (m_base.empty() || m_base == "USD")
+		{
+			return;
+		}
+		const auto usd{ m_snapshot->rate("USD") };
+		if (!usd || *usd == 0.0)
+		{
+			throw std::runtime_error{ "Rate table has no USD rate to rebase on" };
+		}
+		for (auto &rate : m_snapshot->rates)
+		{
+			rate /= *usd;
+		}
+	}
+
+	std::shared_ptr<rate_snapshot> m_snapshot;
+	mode m_mode{ mode::structure };
+	int m_depth{ 0 };
+	std::uint64_t m_objects{ 0 };        // bit n is set when the container at depth n is an object
+	bool m_expect_key{ false };
+	bool m_closed{ false };
+	std::string m_token;
+	std::string m_top_key;
+	std::string m_key;
+	std::string m_base;
+	std::optional<std::int64_t> m_timestamp;
+};
+
+// Decides how long the refresher waits before its next request
+class refresh_schedule
+{
+public:
+	refresh_schedule(std::uint32_t monthly_quota, std::chrono::seconds publish_interval)
+		: m_quota{ monthly_quota }, m_publish_interval{ publish_interval }, m_rng{ std::random_device{}() }
+	{
+	}
+
+	// Replaces the local count with what the provider reports
+	void seed(std::uint32_t used, std::uint32_t quota, std::chrono::system_clock::time_point now)
+	{
+		roll_month(now);
+		m_used = used;
+		m_quota = quota;
+	}
+
+	void set_publish_interval(std::chrono::seconds interval)
+	{
+		m_publish_interval = interval;
+	}
+
+	// Counts one request against this month's quota
+	void consumed(std::chrono::system_clock::time_point now)
+	{
+		roll_month(now);
+		++m_used;
+	}
+
+	// Delay after a successful fetch of rates the provider published at
+	// `published`: just after the next publish, or later if the budget is tight.
+	// When the provider is late and still returns the rates already fetched,
+	// the wait doubles from publish_delay each time instead of polling.
+	std::chrono::seconds after_success(std::int64_t published, std::chrono::system_clock::time_point now)
+	{
+		m_failures = 0;
+		if (m_published && published <= *m_published)
+		{
+			const auto factor{ std::chrono::seconds::rep{ 1 } << std::min(m_stale, 16u) };
+			++m_stale;
+			return std::max(std::min(max_backoff, publish_delay * factor), budget_interval(now));
+		}
+		m_published = published;
+		m_stale = 0;
+		const auto next_publish{ std::chrono::system_clock::time_point{ std::chrono::seconds{ published } } +
+			m_publish_interval + publish_delay };
+		const auto until_publish{ std::max(std::chrono::duration_cast<std::chrono::seconds>(next_publish - now),
+			min_delay) };
+		return std::max(until_publish, budget_interval(now));
+	}
+
+	// Delay after a failed fetch: exponential backoff with full jitter,
+	// but never sooner than the budget allows
+	std::chrono::seconds after_failure(std::chrono::system_clock::time_point now)
+	{
+		const auto factor{ std::chrono::seconds::rep{ 1 } << std::min(m_failures, 16u) };
+		const auto ceiling{ std::min(max_backoff, min_delay * factor) };
+		++m_failures;
+		std::uniform_int_distribution<std::chrono::seconds::rep> jitter{ min_delay.count(), ceiling.count() };
+		return std::max(std::chrono::seconds{ jitter(m_rng) }, budget_interval(now));
+	}
+
+	std::uint32_t used() const
+	{
+		return m_used;
+	}
+
+	std::uint32_t quota() const
+	{
+		return m_quota;
+	}
+
+private:
+	// How long after the expected publish time to fetch, so the new rates are there
+	static constexpr std::chrono::seconds publish_delay{ 60 };
+	static constexpr std::chrono::seconds min_delay{ 5 };
+	static constexpr std::chrono::seconds max_backoff{ 600 };
+
+	// Start of the calendar month (UTC) that now falls in, and of the next one
+	static std::pair<std::chrono::sys_days, std::chrono::sys_days> month_of(std::chrono::system_clock::time_point now)
+	{
+		const std::chrono::year_month_day today{ std::chrono::floor<std::chrono::days>(now) };
+		const auto first{ today.year() / today.month() / 1 };
+		return { std::chrono::sys_days{ first }, std::chrono::sys_days{ first + std::chrono::months{ 1 } } };
+	}
+
+	void roll_month(std::chrono::system_clock::time_point now)
+	{
+		const auto month{ month_of(now).first };
+		if (month != m_month)
+		{
+			m_month = month;
+			m_used = 0;
+		}
+	}
+
+	// Shortest delay the quota allows. While there are more requests left than
+	// fetching after every publish (plus the daily currency list) needs for the
+	// rest of the month there is no limit; past that, the remaining requests are
+	// spread evenly over what's left of the month.
+	std::chrono::seconds budget_interval(std::chrono::system_clock::time_point now)
+	{
+		roll_month(now);
+		const auto left{ std::chrono::duration_cast<std::chrono::seconds>(month_of(now).second - now) };
+		if (m_used >= m_quota)
+		{
+			return left;
+		}
+		const auto remaining{ m_quota - m_used };
+		const auto needed{ left / m_publish_interval + left / std::chrono::hours{ 24 } + 1 };
+		if (remaining > needed)
+		{
+			return std::chrono::seconds{ 0 };
+		}
+		return left / remaining;
+	}
+
+	std::uint32_t m_quota;
+	std::uint32_t m_used{ 0 };
+	std::uint32_t m_failures{ 0 };
+	std::uint32_t m_stale{ 0 };                  // fetches in a row that returned no newer rates
+	std::optional<std::int64_t> m_published;     // timestamp of the newest rates fetched
+	std::chrono::sys_days m_month{};
+	std::chrono::seconds m_publish_interval;
+	std::mt19937 m_rng;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef STATIC_ASSETS_H
+#define STATIC_ASSETS_H
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+/*
+	In-memory cache of the files under doc_root.
+
+	Serving a file from disk costs an open, an fstat, one or more reads and
+	a close on the session's thread for every request. The app only has a
+	handful of small assets, so each one is read once and then served from
+	memory, shared between all the responses that send it. The file's
+	modification time is checked at most once per revalidate_interval, so a
+	changed asset is picked up within about a second without a stat per
+	request. Files over max_file_size aren't cached.
+*/
+
+struct static_asset
+{
+	std::string content;
+	std::string mime;
+	std::filesystem::file_time_type modified;
+};
+
+// A Beast body that sends a cached asset without copying it
+struct asset_body
+{
+	using value_type = std::shared_ptr<const static_asset>;
+
+	static std::uint64_t size(const value_type &body)
+	{
+		return body ? body->content.size() : 0;
+	}
+
+	class writer
+	{
+	public:
+		using const_buffers_type = boost::asio::const_buffer;
+
+		template<bool isRequest, class Fields>
+		writer(boost::beast::http::header<isRequest, Fields> &, const value_type &body)
+			: m_body{ body }
+		{
+		}
+
+		void init(boost::beast::error_code &ec)
+		{
+			ec = {};
+		}
+
+		boost::optional<std::pair<const_buffers_type, bool>> get(boost::beast::error_code &ec)
+		{
+			ec = {};
+			if (!m_body || m_body->content.empty())
+			{
+				return boost::none;
+			}
+			return { { boost::asio::buffer(m_body->content), false } };
+		}
+
+	private:
+		const value_type &m_body;
+	};
+};
+
+class asset_cache
+{
+public:
+	static constexpr std::uint64_t max_file_size = 1024 * 1024;
+	static constexpr std::chrono::seconds revalidate_interval{ 1 };
+
+	explicit asset_cache(bool enabled)
+		: m_enabled{ enabled }
+	{
+	}
+
+	// False when files are to be read from disk for every request
+	bool enabled() const
+	{
+		return m_enabled;
+	}
+
+	// Returns the asset cached under key if it was checked against its
+	// file recently enough to be served as is, else null
+	std::shared_ptr<const static_asset> fresh(const std::string &key,
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+	{
+		std::shared_lock<std::shared_mutex> lock{ m_mutex };
+		const auto found{ m_entries.find(key) };
+		if (found != m_entries.end() && now - found->second.checked < revalidate_interval)
+		{
+			return found->second.asset;
+		}
+		return nullptr;
+	}
+
+	// Returns the asset cached under key, calling load(path, ec) for its
+	// content when it isn't cached yet or the file at path has changed.
+	// Content derived from a file, like a rendered template, needs a key
+	// other than the file's path, or it would be served for the file.
+	// Returns null with ec clear for a file too large to cache, and null
+	// with ec set if the file can't be read.
+	template<class Loader>
+	std::shared_ptr<const static_asset> get(const std::string &key, const std::string &path, std::string_view mime,
+		Loader &&load, boost::beast::error_code &ec)
+	{
+		ec = {};
+		const auto now{ std::chrono::steady_clock::now() };
+		if (auto cached{ fresh(key, now) })
+		{
+			return cached;
+		}
+
+		std::error_code fs_ec;
+		const auto modified{ std::filesystem::last_write_time(path, fs_ec) };
+		if (!fs_ec)
+		{
+			const auto size{ std::filesystem::file_size(path, fs_ec) };
+			if (!fs_ec && size > max_file_size)
+			{
+				return nullptr;
+			}
+		}
+		if (fs_ec)
+		{
+			ec = fs_ec == std::errc::no_such_file_or_directory
+				? boost::beast::error_code{ boost::system::errc::no_such_file_or_directory, boost::system::generic_category() }
+				: boost::beast::error_code{ fs_ec.value(), boost::system::generic_category() };
+			std::unique_lock<std::shared_mutex> lock{ m_mutex };
+			m_entries.erase(key);
+			return nullptr;
+		}
+
+		std::unique_lock<std::shared_mutex> lock{ m_mutex };
+		auto &entry{ m_entries[key] };
+		entry.checked = now;
+		if (entry.asset && entry.asset->modified == modified)
+		{
+			return entry.asset;
+		}
+		lock.unlock();
+
+		auto asset{ std::make_shared<static_asset>() };
+		asset->content = load(path, ec);
+		if (ec)
+		{
+			return nullptr;
+		}
+		asset->mime = std::string{ mime };
+		asset->modified = modified;
+
+		lock.lock();
+		auto &reloaded{ m_entries[key] };
+		reloaded.asset = std::move(asset);
+		reloaded.checked = now;
+		return reloaded.asset;
+	}
+
+	asset_cache(const asset_cache &) = delete;
+	asset_cache &operator=(const asset_cache &) = delete;
+
+private:
+	struct entry
+	{
+		std::shared_ptr<const static_asset> asset;
+		std::chrono::steady_clock::time_point checked{};
+	};
+
+	const bool m_enabled;
+	std::shared_mutex m_mutex;
+	std::unordered_map<std::string, entry> m_entries;
+};
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAS_TSC 1
+#endif
+
+/*
+	Per-request phase tracing.
+
+	A span is a phase of a connection (TLS handshake, reading the request,
+	the upstream fetch, ...) timed with the CPU's timestamp counter where
+	there is one. Finished spans go into a small per-thread ring that keeps
+	only the most recent ones, so tracing costs two clock reads and an
+	uncontended lock per span. Connections are sampled; an unsampled
+	connection records nothing. dump() turns everything still held in the
+	rings into Chrome trace-event JSON, which Perfetto and chrome://tracing
+	can load directly.
+*/
+
+namespace trace
+{
+	enum class phase : std::uint8_t
+	{
+		accept,
+		tls_handshake,
+		read,
+		parse,
+		handle,
+		upstream_resolve,
+		upstream_connect,
+		upstream_handshake,
+		upstream_write,
+		upstream_read,
+		write,
+		count
+	};
+
+	inline constexpr std::array<const char*, static_cast<std::size_t>(phase::count)> phase_names{
+		"accept",
+		"tls_handshake",
+		"read",
+		"parse",
+		"handle",
+		"upstream_resolve",
+		"upstream_connect",
+		"upstream_handshake",
+		"upstream_write",
+		"upstream_read",
+		"write"
+	};
+
+	// Raw monotonic tick count; the TSC on x86, steady_clock elsewhere
+	inline std::uint64_t ticks()
+	{
+#if defined(TRACE_HAS_TSC)
+		return __rdtsc();
+#else
+		return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+	}
+
+	namespace detail
+	{
+		constexpr std::size_t spans_per_thread = 1024;     // must be a power of two
+		constexpr std::size_t max_retired_buffers = 64;
+
+		struct span_record
+		{
+			std::uint64_t start;
+			std::uint64_t end;
+			std::uint64_t connection;
+			std::uint32_t request;
+			phase what;
+		};
+
+		// Ring of the most recent spans finished on one thread. The lock is
+		// only ever contended while a dump is copying the ring out.
+		struct buffer
+		{
+			std::uint64_t thread_id{ 0 };
+			std::mutex mutex;
+			std::uint64_t written{ 0 };
+			std::array<span_record, spans_per_thread> spans;
+		};
+
+		// Ticks and steady_clock sampled together when tracing is first used,
+		// so that the tick rate can be measured over the whole run at dump time
+		struct clock_origin
+		{
+			std::uint64_t ticks;
+			std::chrono::steady_clock::time_point time;
+		};
+	}
+
+	// Identifies one traced connection; requests on it are numbered
+	struct context
+	{
+		std::uint64_t connection{ 0 };
+		std::uint32_t request{ 0 };
+		bool sampled{ false };
+	};
+
+	class tracer
+	{
+	public:
+		static tracer &instance()
+		{
+			static tracer t;
+			return t;
+		}
+
+		// Trace one connection in every `every`; 0 turns tracing off
+		void set_sample_rate(std::uint32_t every)
+		{
+			m_sample_every.store(every, std::memory_order_relaxed);
+		}
+
+		context begin_connection()
+		{
+			context ctx;
+			const auto every{ m_sample_every.load(std::memory_order_relaxed) };
+			ctx.connection = m_connections.fetch_add(1, std::memory_order_relaxed) + 1;
+			ctx.sampled = every != 0 && ctx.connection % every == 0;
+			return ctx;
+		}
+
+		// A context for work the server does on its own, like fetching rates.
+		// It's rare enough to be traced every time tracing is on.
+		context begin_background()
+		{
+			context ctx;
+			ctx.connection = m_connections.fetch_add(1, std::memory_order_relaxed) + 1;
+			ctx.sampled = m_sample_every.load(std::memory_order_relaxed) != 0;
+			return ctx;
+		}
+
+		void record(const context &ctx, phase what, std::uint64_t start, std::uint64_t end)
+		{
+			if (!ctx.sampled)
+			{
+				return;
+			}
+			auto &buf{ local_buffer() };
+			std::lock_guard<std::mutex> lock{ buf.mutex };
+			buf.spans[buf.written++ & (detail::spans_per_thread - 1)] =
+				detail::span_record{ start, end, ctx.connection, ctx.request, what };
+		}
+
+		// Chrome trace-event JSON ("X" complete events, microseconds) for
+		// every span still held in the per-thread rings
+		std::string dump()
+		{
+			std::vector<std::shared_ptr<detail::buffer>> buffers;
+			{
+				std::lock_guard<std::mutex> lock{ m_buffers_mutex };
+				buffers.assign(m_buffers.begin(), m_buffers.end());
+				buffers.insert(buffers.end(), m_retired.begin(), m_retired.end());
+			}
+
+			const auto now_ticks{ ticks() };
+			const auto now{ std::chrono::steady_clock::now() };
+			const auto elapsed_us{ std::chrono::duration<double, std::micro>(now - m_origin.time).count() };
+			const auto ticks_per_us{ elapsed_us > 0.0 ? static_cast<double>(now_ticks - m_origin.ticks) / elapsed_us : 1.0 };
+			const auto to_us = [this, ticks_per_us](std::uint64_t t)
+			{
+				return static_cast<double>(t - m_origin.ticks) / ticks_per_us;
+			};
+
+			std::string out{ "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" };
+			bool first{ true };
+			std::vector<detail::span_record> spans;
+			for (const auto &buf : buffers)
+			{
+				{
+					std::lock_guard<std::mutex> lock{ buf->mutex };
+					const auto count{ std::min<std::uint64_t>(buf->written, detail::spans_per_thread) };
+					spans.clear();
+					for (auto i{ buf->written - count }; i != buf->written; ++i)
+					{
+						spans.push_back(buf->spans[i & (detail::spans_per_thread - 1)]);
+					}
+				}
+				for (const auto &s : spans)
+				{
+					if (s.start < m_origin.ticks)
+					{
+						continue;
+					}
+					out += first ? "" : ",";
+					first = false;
+					out += "{\"name\":\"";
+					out += phase_names[static_cast<std::size_t>(s.what)];
+					out += "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+					out += std::to_string(buf->thread_id);
+					out += ",\"ts\":";
+					out += std::to_string(to_us(s.start));
+					out += ",\"dur\":";
+					out += std::to_string(to_us(s.end) - to_us(s.start));
+					out += ",\"args\":{\"connection\":";
+					out += std::to_string(s.connection);
+					out += ",\"request\":";
+					out += std::to_string(s.request);
+					out += "}}";
+				}
+			}
+			out += "]}";
+			return out;
+		}
+
+		tracer(const tracer &) = delete;
+		tracer &operator=(const tracer &) = delete;
+
+	private:
+		tracer()
+			: m_origin{ ticks(), std::chrono::steady_clock::now() }
+		{
+		}
+
+		// Keeps the thread's ring registered, and moves it to the bounded
+		// retired list when the thread exits so its spans can still be dumped
+		struct buffer_owner
+		{
+			std::shared_ptr<detail::buffer> buf;
+
+			~buffer_owner()
+			{
+				if (buf)
+				{
+					tracer::instance().retire(buf);
+				}
+			}
+		};
+
+		detail::buffer &local_buffer()
+		{
+			thread_local buffer_owner owner;
+			if (!owner.buf)
+			{
+				owner.buf = std::make_shared<detail::buffer>();
+				std::lock_guard<std::mutex> lock{ m_buffers_mutex };
+				owner.buf->thread_id = ++m_threads;
+				m_buffers.push_back(owner.buf);
+			}
+			return *owner.buf;
+		}
+
+		void retire(const std::shared_ptr<detail::buffer> &buf)
+		{
+			std::lock_guard<std::mutex> lock{ m_buffers_mutex };
+			m_buffers.erase(std::remove(m_buffers.begin(), m_buffers.end(), buf), m_buffers.end());
+			m_retired.push_back(buf);
+			if (m_retired.size() > detail::max_retired_buffers)
+			{
+				m_retired.pop_front();
+			}
+		}
+
+		const detail::clock_origin m_origin;
+		std::atomic<std::uint32_t> m_sample_every{ 0 };
+		std::atomic<std::uint64_t> m_connections{ 0 };
+		std::mutex m_buffers_mutex;
+		std::uint64_t m_threads{ 0 };
+		std::vector<std::shared_ptr<detail::buffer>> m_buffers;
+		std::deque<std::shared_ptr<detail::buffer>> m_retired;
+	};
+
+	// Times the enclosing scope as one phase of the given connection
+	class span
+	{
+	public:
+		span(const context &ctx, phase what)
+			: m_ctx{ ctx }, m_what{ what }, m_start{ ctx.sampled ? ticks() : 0 }
+		{
+		}
+
+		~span()
+		{
+			if (m_ctx.sampled)
+			{
+				tracer::instance().record(m_ctx, m_what, m_start, ticks());
+			}
+		}
+
+		span(const span &) = delete;
+		span &operator=(const span &) = delete;
+
+	private:
+		const context &m_ctx;
+		phase m_what;
+		std::uint64_t m_start;
+	};
+}
+
+#endif
@@ -0,0 +1,302 @@
+// Replays a traffic capture recorded by the currency converter server (see
+// currency_converter/capture.hpp) against a running server, and reports the
+// latency of each kind of route.
+//
+// Every captured connection is replayed over one connection of its own,
+// with its requests sent at the times they originally arrived, divided by
+// the speed factor; "max" sends each request as soon as the previous one on
+// its connection has been answered. Start the server with the "replayrates"
+// environment variable naming the same capture file so that it answers
+// from the recorded rates rather than the currency API.
+
+#include "../currency_converter/capture.hpp"
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
+namespace ssl = boost::asio::ssl;       // from <boost/asio/ssl.hpp>
+namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+using boost::asio::awaitable;           // from <boost/asio/awaitable.hpp>
+using boost::asio::use_awaitable;       // from <boost/asio/use_awaitable.hpp>
+using ssl_stream = boost::beast::ssl_stream<boost::beast::tcp_stream>;  // from <boost/beast/ssl.hpp>
+
+// Deadline for each connect, handshake, write or read
+constexpr std::chrono::seconds replay_timeout{ 30 };
+
+// The routes latencies are reported for, named as in the server's "ratelimit" setting
+enum class route
+{
+	static_file,
+	list,
+	convert,
+	locate,
+	count
+};
+
+constexpr std::array<std::string_view, static_cast<std::size_t>(route::count)> route_names{
+	"static",
+	"list",
+	"convert",
+	"locate"
+};
+
+// Latencies and failures for every route, shared by all the connections
+class results
+{
+public:
+	void add(route what, std::chrono::steady_clock::duration latency, bool ok)
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		auto &r{ m_routes[static_cast<std::size_t>(what)] };
+		r.latencies.push_back(std::chrono::duration<double, std::milli>{ latency }.count());
+		r.failures += ok ? 0 : 1;
+	}
+
+	// Adds a request that got no response at all
+	void failed(route what)
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		++m_routes[static_cast<std::size_t>(what)].errors;
+	}
+
+	void print(std::ostream &os, std::chrono::steady_clock::duration elapsed)
+	{
+		std::lock_guard<std::mutex> lock{ m_mutex };
+		os << "replayed in " << std::fixed << std::setprecision(2)
+			<< std::chrono::duration<double>{ elapsed }.count() << " s\n";
+		os << std::left << std::setw(10) << "route" << std::right << std::setw(9) << "requests" << std::setw(8) << "errors"
+			<< std::setw(8) << "non-2xx" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms"
+			<< std::setw(10) << "max ms" << '\n';
+		for (std::size_t i{ 0 }; i != m_routes.size(); ++i)
+		{
+			auto &r{ m_routes[i] };
+			if (r.latencies.empty() && r.errors == 0)
+			{
+				continue;
+			}
+			std::sort(r.latencies.begin(), r.latencies.end());
+			const auto percentile = [&r](double p)
+			{
+				return r.latencies.empty() ? 0.0
+					: r.latencies[std::min(r.latencies.size() - 1, static_cast<std::size_t>(p * r.latencies.size()))];
+			};
+			os << std::left << std::setw(10) << route_names[i] << std::right << std::setw(9) << r.latencies.size() + r.errors
+				<< std::setw(8) << r.errors << std::setw(8) << r.failures << std::setw(10) << percentile(0.5)
+				<< std::setw(10) << percentile(0.9) << std::setw(10) << percentile(0.99)
+				<< std::setw(10) << (r.latencies.empty() ? 0.0 : r.latencies.back()) << '\n';
+		}
+	}
+
+private:
+	struct route_results
+	{
+		std::vector<double> latencies;
+		std::size_t errors{ 0 };
+		std::size_t failures{ 0 };
+	};
+
+	std::mutex m_mutex;
+	std::array<route_results, static_cast<std::size_t>(route::count)> m_routes;
+};
+
+// Sorts a request into the route it would be rate limited and timed as
+route classify(const capture::request_record &r)
+{
+	if (r.target.starts_with("/?q=locate&"))
+	{
+		return route::locate;
+	}
+	if (r.method == "POST" || r.target.starts_with("/?q=convert_all&"))
+	{
+		return route::convert;
+	}
+	return r.target == "/?q=currency_list" ? route::list : route::static_file;
+}
+
+// Sends one captured connection's requests in order, each at its scheduled time
+awaitable<void> replay_connection(ssl::context &ctx, const tcp::resolver::results_type &endpoints,
+	const std::string &host, const std::vector<const capture::request_record *> &requests,
+	std::chrono::steady_clock::time_point start, double speed, results &out)
+{
+	const auto executor{ co_await boost::asio::this_coro::executor };
+	std::optional<ssl_stream> stream;
+	boost::beast::flat_buffer buffer;
+	boost::asio::steady_timer timer{ executor };
+	boost::system::error_code ec;
+
+	for (const auto *r : requests)
+	{
+		const auto what{ classify(*r) };
+		if (speed > 0.0)
+		{
+			timer.expires_at(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double, std::micro>{ r->arrival_us / speed }));
+			co_await timer.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+		}
+
+		// The first request, and any after the server closed the connection,
+		// opens a new one; the connection time isn't counted as latency
+		if (!stream)
+		{
+			stream.emplace(executor, ctx);
+			buffer.clear();
+			boost::beast::get_lowest_layer(*stream).expires_after(replay_timeout);
+			co_await boost::beast::get_lowest_layer(*stream).async_connect(endpoints,
+				boost::asio::redirect_error(use_awaitable, ec));
+			if (!ec)
+			{
+				SSL_set_tlsext_host_name(stream->native_handle(), host.c_str());
+				co_await stream->async_handshake(ssl::stream_base::client, boost::asio::redirect_error(use_awaitable, ec));
+			}
+			if (ec)
+			{
+				out.failed(what);
+				stream.reset();
+				continue;
+			}
+		}
+
+		http::request<http::string_body> req;
+		req.method_string(r->method);
+		req.target(r->target);
+		req.version(11);
+		for (const auto &[name, value] : r->headers)
+		{
+			req.insert(name, value);
+		}
+		req.set(http::field::host, host);
+		req.body() = r->body;
+		req.prepare_payload();
+
+		const auto sent{ std::chrono::steady_clock::now() };
+		boost::beast::get_lowest_layer(*stream).expires_after(replay_timeout);
+		co_await http::async_write(*stream, req, boost::asio::redirect_error(use_awaitable, ec));
+		http::response<http::string_body> res;
+		if (!ec)
+		{
+			co_await http::async_read(*stream, buffer, res, boost::asio::redirect_error(use_awaitable, ec));
+		}
+		if (ec)
+		{
+			out.failed(what);
+			stream.reset();
+			continue;
+		}
+		out.add(what, std::chrono::steady_clock::now() - sent, http::to_status_class(res.result()) == http::status_class::successful);
+		if (!res.keep_alive())
+		{
+			stream.reset();
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 4 && argc != 5)
+	{
+		std::cerr <<
+			"Usage: replay <capture file> <host> <port> [speed]\n" <<
+			"The speed is a multiple of the captured rate (default 1), or \"max\".\n" <<
+			"Example:\n" <<
+			"    ./replay traffic.cap localhost 8080 10\n";
+		return EXIT_FAILURE;
+	}
+	const std::string host{ argv[2] };
+	const double speed{ argc == 5 ? (std::string_view{ argv[4] } == "max" ? 0.0 : std::atof(argv[4])) : 1.0 };
+	if (argc == 5 && std::string_view{ argv[4] } != "max" && speed <= 0.0)
+	{
+		std::cerr << "The speed must be a positive number or \"max\"\n";
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		// Requests grouped by the connection they arrived on, in order
+		std::vector<capture::request_record> records;
+		std::size_t omitted{ 0 };
+		capture::reader reader{ argv[1] };
+		while (auto next{ reader.next() })
+		{
+			if (auto *r{ std::get_if<capture::request_record>(&*next) })
+			{
+				if (r->body_omitted)
+				{
+					// CSV uploads are captured without their bodies
+					++omitted;
+					continue;
+				}
+				records.push_back(std::move(*r));
+			}
+		}
+		std::map<std::uint64_t, std::vector<const capture::request_record *>> connections;
+		for (const auto &r : records)
+		{
+			connections[r.connection].push_back(&r);
+		}
+		std::cerr << "replaying " << records.size() << " requests on " << connections.size() << " connections";
+		if (omitted != 0)
+		{
+			std::cerr << " (skipping " << omitted << " CSV uploads)";
+		}
+		std::cerr << '\n';
+
+		const auto threads{ std::max(1u, std::thread::hardware_concurrency()) };
+		boost::asio::io_context ioc{ static_cast<int>(threads) };
+
+		// The server's certificate is usually self-signed, and isn't what's being measured
+		ssl::context ctx{ ssl::context::tlsv12_client };
+		ctx.set_verify_mode(ssl::verify_none);
+
+		tcp::resolver resolver{ ioc };
+		const auto endpoints{ resolver.resolve(host, argv[3]) };
+
+		results out;
+		const auto start{ std::chrono::steady_clock::now() };
+		for (const auto &[id, requests] : connections)
+		{
+			boost::asio::co_spawn(boost::asio::make_strand(ioc),
+				replay_connection(ctx, endpoints, host, requests, start, speed, out), boost::asio::detached);
+		}
+
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		for (auto i{ threads - 1 }; i > 0; --i)
+		{
+			workers.emplace_back([&ioc] { ioc.run(); });
+		}
+		ioc.run();
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+		out.print(std::cout, std::chrono::steady_clock::now() - start);
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << "Error: " << e.what() << '\n';
+		return EXIT_FAILURE;
+	}
+}